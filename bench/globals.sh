@@ -0,0 +1,52 @@
+#!/bin/sh
+# Times lookups of globals for a growing number of globals, to show that the
+# cost of a lookup does not depend on how many there are.
+#
+#   bench/globals.sh path/to/plisp [lines]
+#
+# For each count N a script defines the globals g0 .. gN-1, and a second one
+# evaluates `lines` forms of 50 lookups each, of globals picked at random with
+# a fixed seed. Every form is compiled once and run once, so each lookup goes
+# to the table rather than to an instruction's cache. The time of the lookups
+# is that of running both scripts minus that of only defining, best of three.
+# All globals are 0, so printing the forms costs the same for every N.
+# Needs a date that supports %N.
+
+plisp=${1:?usage: $0 path/to/plisp [lines]}
+lines=${2:-10000}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+now() {
+    date +%s%N
+}
+
+# Best of three runs of plisp on the given files, in nanoseconds
+best() {
+    min=
+    for run in 1 2 3; do
+        start=$(now)
+        "$plisp" "$@" > /dev/null
+        t=$(($(now) - start))
+        if [ -z "$min" ] || [ "$t" -lt "$min" ]; then min=$t; fi
+    done
+    echo "$min"
+}
+
+printf '%8s %12s %14s\n' globals lookups ns/lookup
+for n in 10 100 1000 10000 100000; do
+    awk -v n="$n" 'BEGIN {for (i = 0; i < n; i++) printf "def {g%d} 0\n", i}' > "$dir/defs"
+    awk -v n="$n" -v lines="$lines" 'BEGIN {
+        srand(1)
+        for (l = 0; l < lines; l++) {
+            printf "list"
+            for (i = 0; i < 50; i++) printf " g%d", int(rand() * n)
+            printf "\n"
+        }
+    }' > "$dir/lookups"
+
+    defs=$(best "$dir/defs")
+    both=$(best "$dir/defs" "$dir/lookups")
+    lookups=$((lines * 50))
+    printf '%8d %12d %14d\n' "$n" "$lookups" $(((both - defs) / lookups))
+done
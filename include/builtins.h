@@ -1,8 +1,26 @@
 #pragma once
 
 #include "lval.h"
+#include "lvm.h"
+
+/*
+ * What a builtin requires of its arguments: `args` of them, or any number
+ * if it is -1, each of type `type` unless that is -1. `result` is the type
+ * it returns when it does not fail, or -1 if that is not known. The compiler
+ * reports calls that cannot match before running them, and calls `unchecked`
+ * instead of `fun` where it has proven that they match.
+ */
+typedef struct {
+    lbuiltin fun;
+    lbuiltin unchecked;
+    char* name;
+    int args;
+    int type;
+    int result;
+} lsig;
+
+const lsig* builtin_sig(lbuiltin fun);
 
-lval* builtin_op(lenv* e, lval* a, char* op);
 lval* builtin_add(lenv* e, lval* a);
 lval* builtin_sub(lenv* e, lval* a);
 lval* builtin_mul(lenv* e, lval* a);
@@ -14,7 +32,10 @@ lval* builtin_list(lenv* e, lval* a);
 lval* builtin_eval(lenv* e, lval* a);
 lval* builtin_join(lenv* e, lval* a);
 lval* builtin_def(lenv* e, lval* a);
+lval* builtin_let(lenv* e, lval* a);
+lval* builtin_lambda(lenv* e, lval* a);
+lval* builtin_mem(lenv* e, lval* a);
+lval* builtin_gc(lenv* e, lval* a);
+lval* builtin_save(lenv* e, lval* a);
+lval* builtin_load(lenv* e, lval* a);
 
-lval* lval_eval_sexpr(lenv* e, lval* v);
-lval* lval_eval(lenv* e, lval* v);
-lval* lval_eval_sexpr(lenv* e, lval* v);
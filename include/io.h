@@ -1,15 +1,19 @@
 #pragma once
 #include "lval.h"
+#include "lwrite.h"
 #include "../lib/mpc.h"
 
+lval* lval_read_number(char* s);
+
 lval* lval_read_num(mpc_ast_t* t);
 
 lval* lval_read(mpc_ast_t* t);
 
-void lval_print(lval* v);
-
-void lval_expr_print(lval* v, char open, char close);
+void lval_write(lwriter* w, lval* v);
 
+//Print to stdout through a shared writer that is flushed after each value
 void lval_print(lval* v);
 
 void lval_println(lval* v);
+
+void lval_print_cleanup(void);
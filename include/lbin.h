@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include "lval.h"
+#include "lwrite.h"
+
+/*
+ * Binary encoding of values, for data that is saved once and loaded many
+ * times. An encoding starts with LBIN_MAGIC and a version byte, followed by
+ * every distinct symbol name once and then the value itself:
+ *
+ *   symbols : <count> (<length> <bytes>)*
+ *   value   : LBIN_NUM <8 bytes>    the bits of the double, little endian
+ *           | LBIN_INT <zigzag>
+ *           | LBIN_ERR <length> <bytes>
+ *           | LBIN_SYM <index>      into the symbols
+ *           | LBIN_SEXPR <count> <value>*
+ *           | LBIN_QEXPR <count> <value>*
+ *
+ * Counts, lengths and indices are unsigned LEB128 varints. Functions have
+ * no encoding, they refer to environments that are not saved with them.
+ */
+#define LBIN_MAGIC "plsb"
+#define LBIN_VERSION 1
+
+enum {LBIN_NUM, LBIN_INT, LBIN_ERR, LBIN_SYM, LBIN_SEXPR, LBIN_QEXPR};
+
+//Both return NULL on success, or the error
+lval* lbin_encode(lwriter* w, lval* v);
+lval* lbin_save(const char* path, lval* v);
+
+//Both return the value, or an error if the data is not a valid encoding
+lval* lbin_decode(const char* data, size_t n);
+//Decodes straight from the file mapped into memory, on Windows from a copy
+//read with stdio
+lval* lbin_load(const char* path);
@@ -5,16 +5,41 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include "lval.h"
+#include "lsym.h"
 
+/*
+ * The global environment has no parent and is an open addressing hash table
+ * keyed on interned symbols, its capacity is a power of two.
+ *
+ * Every nested scope is a frame: a fixed array of `count` slots whose names
+ * are known up front, chained to the enclosing scope through `par`. The
+ * compiler resolves names bound in frames to (depth, slot) pairs, so frames
+ * are normally accessed by index and only searched by name from code that
+ * is compiled at run time. Frames are reference counted, as functions
+ * keep the frame they were created in alive.
+ */
 struct lenv {
+    lenv* par;
+    int refs;
     int count;
-    char** syms;
+    int capacity;
+    lsym** syms;
     lval** vals;
 };
 
+//Changes whenever a global is bound, see lcache
+extern uint64_t lenv_version;
+//Changes whenever a global bound to a builtin is rebound, see lsig
+extern uint64_t lenv_builtin_version;
+
 lenv* lenv_new(void);
+lenv* lenv_new_frame(lenv* par, int count);
+lenv* lenv_ref(lenv* e);
 void lenv_del(lenv* e);
+lenv* lenv_root(lenv* e);
+int lenv_find(lenv* e, lsym* k);
 void lenv_put(lenv* e, lval* k, lval* v);
+void lenv_def(lenv* e, lval* k, lval* v);
 void lenv_add_builtin(lenv* e, char* name, lbuiltin func);
 void lenv_add_builtins(lenv* e);
 lval* lenv_get(lenv* e, lval* k);
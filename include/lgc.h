@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include "lval.h"
+
+/*
+ * Heap for lval nodes plus a mark-and-sweep collector that backs up the
+ * reference counts.
+ *
+ * Reference counting frees a value as soon as its last owner lets go. The
+ * collector frees the nodes that are still counted but can no longer be
+ * reached, such as those whose owner forgot to lval_del them. It traces from
+ * the roots: the global environment and what the VM holds, its value stack
+ * and the frames it is running with their environments and code. Values
+ * held only in C locals are not roots, so a collection only runs where there
+ * are none: after a top-level evaluation, or from a builtin that holds no
+ * values itself (see lvm_mark_roots).
+ *
+ * A collection is triggered once the number of live nodes reaches the
+ * threshold, which is reset to twice the surviving nodes afterwards but
+ * never below min_threshold.
+ */
+#define LGC_NODES_PER_SLAB 2048
+#define LGC_MIN_THRESHOLD 65536
+
+//Bits of lval.mark. Heap nodes that are allocated or modified while the
+//arena is open are young, they may point into the arena until promoted.
+#define LGC_MARKED 1
+#define LGC_YOUNG 2
+
+typedef struct {
+    size_t collections;
+    size_t live;
+    size_t heap;
+    size_t threshold;
+    size_t min_threshold;
+    size_t last_freed;
+    size_t total_freed;
+    double last_pause_ms;
+    double total_pause_ms;
+} lgc_stats;
+
+lval* lgc_alloc(void);
+void lgc_free(lval* v);
+//Both collect with the global scope of e as the root environment
+size_t lgc_collect(lenv* e);
+void lgc_maybe_collect(lenv* e);
+//Roots that lvm_mark_roots reports
+void lgc_root(lval* v);
+void lgc_root_env(lenv* e);
+void lgc_root_code(struct lcode* c);
+void lgc_set_min_threshold(size_t nodes);
+void lgc_get_stats(lgc_stats* stats);
+void lgc_cleanup(void);
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Size-class slab allocator used for lval nodes, cell arrays and strings.
+ * Requests up to LMEM_MAX_SIZE bytes are rounded up to a power of two and
+ * served from per-class free lists that are refilled from 64KiB slabs.
+ * Larger requests go straight to malloc. Callers pass the size back on
+ * free/realloc so no per-allocation header is needed.
+ */
+#define LMEM_MIN_SIZE 16
+#define LMEM_MAX_SIZE 512
+#define LMEM_CLASSES 6
+#define LMEM_SLAB_SIZE (64 * 1024)
+
+typedef struct {
+    size_t size;
+    size_t slabs;
+    size_t live;
+    size_t free;
+} lmem_class_stats;
+
+/*
+ * Arena for the temporaries of one top-level evaluation. While it is open
+ * lmem_alloc, and lgc_alloc for nodes, bump allocate from a single block
+ * that is released in one go by lmem_arena_close. Freeing memory from the
+ * arena only gives it back if it was the last allocation, so values that are
+ * freed in the order they were made are reused within the evaluation.
+ * Requests that no longer fit spill over to the heap. Anything that outlives
+ * the evaluation must be moved to the heap before the arena is closed, see
+ * lval_promote. Long lived allocations such as interned symbols suspend the
+ * arena around themselves.
+ */
+#define LMEM_ARENA_SIZE (1024 * 1024)
+
+void lmem_arena_open(void);
+void lmem_arena_close(void);
+int lmem_arena_active(void);
+int lmem_arena_suspend(void);
+void lmem_arena_resume(int active);
+void* lmem_arena_alloc(size_t size);
+
+extern char* lmem_arena;
+
+static inline int lmem_in_arena(const void* p) {
+    return (uintptr_t)p - (uintptr_t)lmem_arena < LMEM_ARENA_SIZE;
+}
+
+void* lmem_alloc(size_t size);
+void* lmem_realloc(void* p, size_t old_size, size_t new_size);
+void lmem_free(void* p, size_t size);
+void lmem_stats(lmem_class_stats* stats);
+void lmem_cleanup(void);
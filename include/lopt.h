@@ -0,0 +1,16 @@
+#pragma once
+
+#include "lval.h"
+
+/*
+ * Constant folding. The compiler replaces a call by its result if its
+ * function is a global bound to a pure builtin, all of its arguments are
+ * constants and evaluating it succeeds. Numbers and Q-expressions are
+ * constants, and so is every call that was folded. Only strict code is
+ * folded, and the result only holds while the builtins stay bound as they
+ * were, see LOP_FOLDED.
+ *
+ * lopt_value computes the result of the call of f on args, NULL if it cannot
+ * be folded. It takes over args.
+ */
+lval* lopt_value(lenv* scope, lval* f, lval* args);
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdio.h>
+#include "lval.h"
+
+/*
+ * Reader that scans the plisp grammar straight into values in one pass,
+ * without building an mpc AST first. It accepts exactly what the mpc grammar
+ * in plisp.c accepts and gives the same S-expression of the forms read.
+ *
+ * Input that cannot be read is scanned a second time to collect what was
+ * expected at the furthest position reached, the same way mpc merges its
+ * errors, so the message matches the one mpc_err_print would give.
+ */
+//Returns NULL on failure and sets err to the message, which the caller frees
+lval* lread_string(const char* filename, const char* s, char** err);
+
+/*
+ * Reads the top-level forms of a file or pipe one at a time, as if the whole
+ * input was read by the grammar above, so a script runs form by form without
+ * ever holding more than the form being read. The buffer starts at
+ * LREAD_CHUNK bytes and only grows to fit a form that is larger.
+ *
+ * Errors give the row and column in the whole input. `row` and `col` are
+ * where the last form read starts, counting from 1.
+ */
+#define LREAD_CHUNK (64 * 1024)
+
+typedef struct lstream {
+    FILE* file;
+    char* filename;
+    char* buf;
+    size_t capacity;
+    size_t len;
+    size_t pos;
+    int eof;
+    //Position of buf[pos]
+    int pos_row;
+    long pos_col;
+    //Where the last form started if it was an atom that ran right up to
+    //pos, mpc expects it to go on as well, -1 otherwise
+    long tail;
+    int row;
+    long col;
+} lstream;
+
+lstream* lstream_new(FILE* file, const char* filename);
+void lstream_del(lstream* s);
+//The next form, NULL at the end of the input or if it cannot be read, then
+//err is set to the message and the caller frees it
+lval* lstream_read(lstream* s, char** err);
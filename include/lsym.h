@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Interned symbol names. Every distinct name is stored exactly once, so two
+ * symbols are equal iff their lsym pointers are equal. Entries live until
+ * lsym_cleanup.
+ */
+typedef struct lsym {
+    char* name;
+    uint32_t hash;
+    struct lsym* next;
+} lsym;
+
+lsym* lsym_intern(char* name);
+void lsym_cleanup(void);
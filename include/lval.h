@@ -1,31 +1,169 @@
 #pragma once
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+
 struct lval;
 struct lenv;
+struct lsym;
+struct lcode;
+struct llambda;
 typedef struct lval lval;
 typedef struct lenv lenv;
 
-enum {LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_FUN, LVAL_SEXPR , LVAL_QEXPR};
+enum {LVAL_NUM, LVAL_INT, LVAL_ERR, LVAL_SYM, LVAL_FUN, LVAL_LAMBDA, LVAL_SEXPR , LVAL_QEXPR};
 char* ltype_name(int t);
 typedef lval*(*lbuiltin)(lenv*, lval*);
-lval* lval_num(double x);
+lval* lval_int_box(int64_t x);
 lval* lval_err(char* fmt, ...);
 lval* lval_sym(char* s);
 lval* lval_fun(lbuiltin func);
+lval* lval_lambda(lenv* env, lval* formals, lval* body);
 lval* lval_sexpr(void);
 lval* lval_qexpr(void);
 void lval_del(lval* v);
+void lval_free(lval* v);
 lval* lval_add(lval* v, lval* x);
+lval* lval_reserve(lval* v, int capacity);
+lval* lval_append(lval* v, lval** xs, int n);
+lval* lval_splice(lval* v, int i, int n, lval** xs, int m);
+lval* lval_ref(lval* v);
 lval* lval_copy(lval* v);
+lval* lval_unshare(lval* v);
+lval* lval_slice(lval* v, int start, int n);
 lval* lval_join(lval* x, lval* y);
 lval* lval_pop(lval* v, int i);
 lval* lval_take(lval* v, int i);
+lval* lval_promote(lval* v);
+
+/*
+ * Backing array of S- and Q-expressions. Several expressions may view
+ * different ranges of the same lvec, which holds a reference to each of its
+ * first `len` items for as long as any of them is alive. `code` caches the
+ * compiled form of the items and is dropped whenever they change.
+ */
+typedef struct lvec {
+    uint32_t refs;
+    uint32_t mark;
+    int len;
+    int capacity;
+    struct lcode* code;
+    struct lval* items[];
+} lvec;
+
+/*
+ * A user defined function. Its `count` formals become the slots of a frame
+ * created for each call, chained to the scope the function was created in,
+ * or to the global scope if `env` is NULL. If `variadic` is set, the last
+ * slot collects the remaining arguments as a Q-expression. `formals` and
+ * `body` are kept as written, the body is compiled once on its first call.
+ */
+typedef struct llambda {
+    int count;
+    int variadic;
+    lval* formals;
+    lval* body;
+    lenv* env;
+    struct lcode* code;
+    struct lsym* syms[];
+} llambda;
 
+/*
+ * Only the payload matching `type` is live, so the payloads share storage.
+ * For S- and Q-expressions `cell` points `off` items into an lvec and the
+ * expression is the `count` items from there on, so head and tail only have
+ * to move the window. A node is 24 bytes on 64 bit platforms.
+ *
+ * Nodes are reference counted: lval_ref hands out another reference and
+ * lval_del drops one. A node with more than one reference is shared and must
+ * not be modified in place; lval_unshare gives a private copy first.
+ */
 typedef struct lval {
-    int type;
-    double num;
-    char* err;
-    char* sym;
-    lbuiltin fun;
+    uint8_t type;
+    uint8_t mark;
+    uint32_t refs;
     int count;
-    struct lval** cell;
+    int off;
+    union {
+        int64_t inum;
+        char* err;
+        struct lsym* sym;
+        lbuiltin fun;
+        llambda* lambda;
+        struct lval** cell;
+    };
 } lval;
+
+/*
+ * Numbers are not heap allocated. They are NaN-boxed into the lval* handle
+ * itself: the bits of a double are offset by 2^49, which moves every double
+ * out of the range used by real pointers (whose top 15 bits are zero on all
+ * supported 64 bit platforms). NaNs are canonicalised first so that no double
+ * wraps around into pointer space. Offset doubles never reach 0xfff3 in the
+ * top 16 bits, which leaves room for integers that fit in 48 bits to be
+ * stored under the 0xfffc tag. Larger integers are boxed in an LVAL_INT node.
+ */
+typedef char lval_requires_64bit_pointers[sizeof(void*) == 8 ? 1 : -1];
+
+#define LVAL_NUM_OFFSET ((uint64_t)1 << 49)
+#define LVAL_NUM_CANONICAL_NAN ((uint64_t)0x7ff8000000000000)
+#define LVAL_INT_TAG ((uint64_t)0xfffc)
+#define LVAL_INT_MIN (-((int64_t)1 << 47))
+#define LVAL_INT_MAX (((int64_t)1 << 47) - 1)
+
+static inline int lval_is_imm(const lval* v) {
+    return ((uintptr_t)v >> 49) != 0;
+}
+
+static inline int lval_is_imm_int(const lval* v) {
+    return ((uintptr_t)v >> 48) == LVAL_INT_TAG;
+}
+
+static inline lval* lval_num(double x) {
+    uint64_t bits;
+    if (x != x) {
+        bits = LVAL_NUM_CANONICAL_NAN;
+    } else {
+        memcpy(&bits, &x, sizeof(bits));
+    }
+    return (lval*)(uintptr_t)(bits + LVAL_NUM_OFFSET);
+}
+
+static inline double lval_get_num(const lval* v) {
+    uint64_t bits = (uint64_t)(uintptr_t)v - LVAL_NUM_OFFSET;
+    double x;
+    memcpy(&x, &bits, sizeof(x));
+    return x;
+}
+
+static inline lval* lval_int(int64_t x) {
+    if (x < LVAL_INT_MIN || x > LVAL_INT_MAX) {return lval_int_box(x);}
+    uint64_t payload = (uint64_t)x & (((uint64_t)1 << 48) - 1);
+    return (lval*)(uintptr_t)((LVAL_INT_TAG << 48) | payload);
+}
+
+static inline int64_t lval_get_int(const lval* v) {
+    if (!lval_is_imm(v)) {return v->inum;}
+    //Sign extend the 48 bit payload
+    return (int64_t)((uint64_t)(uintptr_t)v << 16) >> 16;
+}
+
+static inline int lval_type(const lval* v) {
+    if (lval_is_imm(v)) {return lval_is_imm_int(v) ? LVAL_INT : LVAL_NUM;}
+    return v->type;
+}
+
+static inline int lval_is_number(const lval* v) {
+    int t = lval_type(v);
+    return t == LVAL_NUM || t == LVAL_INT;
+}
+
+//Numeric value of an LVAL_INT or LVAL_NUM as a double
+static inline double lval_to_double(const lval* v) {
+    return lval_type(v) == LVAL_INT ? (double)lval_get_int(v) : lval_get_num(v);
+}
+
+static inline lvec* lval_vec(const lval* v) {
+    if (v->cell == NULL) {return NULL;}
+    return (lvec*)((char*)(v->cell - v->off) - offsetof(lvec, items));
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stdint.h>
+#include "lval.h"
+
+/*
+ * Bytecode compiler and stack machine used for all evaluation. An expression
+ * compiles to a flat list of 32 bit instructions, the opcode in the low 8
+ * bits and its operand in the upper 24 bits.
+ *
+ *   CONST k    push constant k
+ *   GLOBAL k   push the global value looked up through cache entry k
+ *   LOCAL d,i  push slot i of the frame d levels up from the current one
+ *   LOOKUP k   push the value bound to symbol constant k, searching all scopes
+ *   CALL n     pop n values and push their evaluation as an S-expression
+ *   CALL_PROVEN k
+ *              CALL of a builtin whose arguments were proven to match its
+ *              signature, described by check entry k
+ *   FOLDED k   push the result of the call compiled after it instead of
+ *              running that code, as described by fold entry k
+ *   RETURN     pop the result and stop
+ *
+ * Code is compiled against a scope. Symbols bound in one of its frames are
+ * resolved to LOCAL slot accesses at compile time, all others are globals.
+ * LOOKUP is only used when a frame is too deep or too large to be encoded.
+ *
+ * Code compiled in the global scope from an expression is cached on its
+ * lvec, so evaluating the same Q-expression repeatedly only compiles it once.
+ */
+enum {LOP_CONST, LOP_GLOBAL, LOP_LOCAL, LOP_LOOKUP, LOP_CALL, LOP_CALL_PROVEN, LOP_FOLDED,
+      LOP_RETURN};
+
+#define LOP(op, arg) ((uint32_t)(op) | ((uint32_t)(arg) << 8))
+#define LOP_CODE(ins) ((ins) & 0xff)
+#define LOP_ARG(ins) ((ins) >> 8)
+#define LOP_LOCAL_ARG(depth, slot) (((depth) << 16) | (slot))
+#define LOP_MAX_DEPTH 0xff
+#define LOP_MAX_SLOT 0xffff
+
+/*
+ * Function calls and eval do not recurse in C. They push a frame on the
+ * VM's own stack, or replace the calling frame if the call is the last
+ * thing it does, so recursion in tail position runs in constant space.
+ * Other recursion fails with an error once it is max depth frames deep.
+ *
+ * Every error is passed on by every call it is an argument of, so the first
+ * error ends the run right away and becomes its result. Nothing after it is
+ * evaluated.
+ *
+ * A builtin can end by returning lvm_enter(e, v) to have the VM evaluate v
+ * as an S-expression in e in its place. It takes over v.
+ */
+#define LVM_DEFAULT_MAX_DEPTH 100000
+
+/*
+ * Each GLOBAL instruction has a cache entry remembering the value its symbol
+ * was bound to. The entry is valid while `version` matches lenv_version,
+ * which changes whenever a global is bound, so a redefinition takes effect
+ * on the next lookup. The value is not referenced by the entry, it is kept
+ * alive by its binding for as long as the entry is valid.
+ */
+typedef struct lcache {
+    lval* sym;
+    uint64_t version;
+    lval* value;
+} lcache;
+
+/*
+ * A call compiled as CALL_PROVEN goes through the unchecked entry of its
+ * builtin while no global bound to a builtin has been rebound since, that is
+ * while `version` matches lenv_builtin_version. Calls the compiler proves can
+ * never succeed are reported as `error` and the code is not run at all. That
+ * is only done for `strict` code, which cannot rebind a builtin before its
+ * calls are made. Other code makes such calls as compiled and the builtins
+ * report what is wrong, if they are still bound the same.
+ */
+typedef struct lcheck {
+    int n;
+    lbuiltin unchecked;
+    uint64_t version;
+} lcheck;
+
+/*
+ * Calls of pure builtins on constants are computed by the compiler (see
+ * lopt_value), their result is constant `value`. It stands in for the `skip`
+ * instructions of the call while `version` matches lenv_builtin_version,
+ * after that the call is run as compiled.
+ */
+typedef struct lfold {
+    int value;
+    int skip;
+    uint64_t version;
+} lfold;
+
+typedef struct lcode {
+    uint32_t* ops;
+    int count;
+    int capacity;
+    lval** consts;
+    int const_count;
+    int const_capacity;
+    lcache* caches;
+    int cache_count;
+    int cache_capacity;
+    lcheck* checks;
+    int check_count;
+    int check_capacity;
+    lfold* folds;
+    int fold_count;
+    int fold_capacity;
+    lval* error;
+    int strict;
+    int max_stack;
+    //Window of the lvec the code was compiled from
+    int off;
+    int len;
+} lcode;
+
+lcode* lcode_compile(lval* v, lenv* scope);
+lcode* lcode_compile_sexpr(lval* v, lenv* scope);
+lval* lcode_compile_lambda(lval* f, lenv* e);
+void lcode_del(lcode* c);
+void lvm_set_max_depth(int depth);
+lval* lvm_enter(lenv* e, lval* v);
+//Prints every call the compiler folds and its result
+void lvm_set_dump_folds(int dump);
+//Reports the values the running evaluation holds to the collector
+void lvm_mark_roots(void);
+void lvm_cleanup(void);
+
+lval* lval_eval(lenv* e, lval* v);
+lval* lval_eval_sexpr(lenv* e, lval* v);
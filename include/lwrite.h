@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Buffered writer for printing values. Output collects in a buffer of
+ * LWRITE_CHUNK bytes that is handed on in one piece when it fills up or is
+ * flushed, to a stdio stream, a file descriptor, or, for a string writer,
+ * kept growing until it is taken.
+ *
+ * Numbers are formatted by hand with the same result as printf would give,
+ * without parsing a format for each of them.
+ */
+#define LWRITE_CHUNK (64 * 1024)
+
+typedef struct lwriter {
+    FILE* file;
+    int fd;
+    char* buf;
+    size_t capacity;
+    size_t len;
+    //Set once a write has failed, later output is dropped
+    int error;
+} lwriter;
+
+lwriter* lwriter_file(FILE* file);
+//Windows only has the stdio writers
+#ifndef _WIN32
+lwriter* lwriter_fd(int fd);
+#endif
+lwriter* lwriter_string(void);
+//Flushes what is left before freeing the writer
+void lwriter_del(lwriter* w);
+//Returns -1 if any output could not be written
+int lwriter_flush(lwriter* w);
+//The NUL terminated output of a string writer, which is reset. The caller
+//frees it
+char* lwriter_take(lwriter* w);
+
+void lwriter_put(lwriter* w, const char* s, size_t n);
+void lwriter_puts(lwriter* w, const char* s);
+void lwriter_int(lwriter* w, int64_t x);
+//Same as printf("%.*f", prec, x), which it falls back to for a prec over 3
+//or an x that does not fit into 64 bits
+void lwriter_fixed(lwriter* w, double x, int prec);
+
+static inline void lwriter_putc(lwriter* w, char c) {
+    if (w->len == w->capacity) {lwriter_put(w, &c, 1); return;}
+    w->buf[w->len++] = c;
+}
@@ -2,6 +2,10 @@
 #include <string.h>
 #include "../include/builtins.h"
 #include "../include/lenv.h"
+#include "../include/lmem.h"
+#include "../include/lgc.h"
+#include "../include/lsym.h"
+#include "../include/lbin.h"
 
 #define LASSERT(args, cond, fmt, ...) \
     if (!(cond)) { \
@@ -21,88 +25,277 @@
             func, i)
 
 #define LASSERT_TYPE(args, func, i, expected) \
-    LASSERT(args, args->cell[i]->type == expected,\
+    LASSERT(args, lval_type(args->cell[i]) == expected,\
         "Function '%s' passed incorrect type at index %i! Got %s, expected %s.", \
-        func, i, ltype_name(args->cell[i]->type), ltype_name(expected))
+        func, i, ltype_name(lval_type(args->cell[i])), ltype_name(expected))
 
-int is_int(double val) {
-    return ceilf(val) == val;
+#define LASSERT_NUMBER(args, func, i) \
+    LASSERT(args, lval_is_number(args->cell[i]),\
+        "Function '%s' passed incorrect type at index %i! Got %s, expected %s.", \
+        func, i, ltype_name(lval_type(args->cell[i])), ltype_name(LVAL_NUM))
+
+/*
+ * Each operator is a kernel of two steps, selected once per call: an exact
+ * integer step that returns 0 if the result needs a double instead, and a
+ * double step that may fail with an error. Operators whose integer steps
+ * only add or subtract can sum runs of operands before applying them.
+ */
+typedef struct {
+    int (*exact)(int64_t x, int64_t y, int64_t* r);
+    lval* (*inexact)(double* x, double y);
+    int divides;
+    int sign;
+} arith_op;
+
+#if defined(__GNUC__) || defined(__clang__)
+#define ARITH_OVERFLOW_BUILTINS
+#endif
+
+#ifdef ARITH_OVERFLOW_BUILTINS
+static int add_exact(int64_t x, int64_t y, int64_t* r) {
+    return !__builtin_add_overflow(x, y, r);
 }
 
-lval* builtin_op(lenv* e, lval* a, char* op) {
-    for (int i=0; i < a->count; i++) {
-        LASSERT_TYPE(a, "op", i, LVAL_NUM)
+static int sub_exact(int64_t x, int64_t y, int64_t* r) {
+    return !__builtin_sub_overflow(x, y, r);
+}
+
+static int mul_exact(int64_t x, int64_t y, int64_t* r) {
+    return !__builtin_mul_overflow(x, y, r);
+}
+#else
+//Checks the operands before computing, signed overflow is undefined
+static int add_exact(int64_t x, int64_t y, int64_t* r) {
+    if (y > 0 ? x > INT64_MAX - y : x < INT64_MIN - y) {return 0;}
+    *r = x + y;
+    return 1;
+}
+
+static int sub_exact(int64_t x, int64_t y, int64_t* r) {
+    if (y < 0 ? x > INT64_MAX + y : x < INT64_MIN + y) {return 0;}
+    *r = x - y;
+    return 1;
+}
+
+static int mul_exact(int64_t x, int64_t y, int64_t* r) {
+    if (x > 0 ? (y > 0 ? x > INT64_MAX / y : y < INT64_MIN / x)
+              : (y > 0 ? x < INT64_MIN / y : x != 0 && y < INT64_MAX / x)) {
+        return 0;
     }
+    *r = x * y;
+    return 1;
+}
+#endif
 
-    lval* x = lval_pop(a, 0);
+static int div_exact(int64_t x, int64_t y, int64_t* r) {
+    if (y == -1) {return sub_exact(0, x, r);}
+    if (x % y != 0) {return 0;}
+    *r = x / y;
+    return 1;
+}
+
+static int mod_exact(int64_t x, int64_t y, int64_t* r) {
+    *r = y == -1 ? 0 : x % y;
+    return 1;
+}
+
+static lval* add_inexact(double* x, double y) {*x += y; return NULL;}
+static lval* sub_inexact(double* x, double y) {*x -= y; return NULL;}
+static lval* mul_inexact(double* x, double y) {*x *= y; return NULL;}
+static lval* div_inexact(double* x, double y) {*x /= y; return NULL;}
+
+static lval* mod_inexact(double* x, double y) {
+    if (floor(*x) == *x && floor(y) == y) {
+        *x = fmod(*x, y);
+        return NULL;
+    }
+    return lval_err("Modulo works only on integers, got x=%f and y=%f.", *x, y);
+}
+
+static const arith_op arith_add = {add_exact, add_inexact, 0, 1};
+static const arith_op arith_sub = {sub_exact, sub_inexact, 0, -1};
+static const arith_op arith_mul = {mul_exact, mul_inexact, 0, 0};
+static const arith_op arith_div = {div_exact, div_inexact, 1, 0};
+static const arith_op arith_mod = {mod_exact, mod_inexact, 1, 0};
+
+//Immediate integers have 48 bits, so a block of 2^14 of them sums to less
+//than 2^61 in magnitude and adding it to anything below 2^62 cannot overflow
+#define ARITH_BLOCK (1 << 14)
+#define ARITH_BLOCK_LIMIT ((int64_t)1 << 62)
+
+//Straight line loops over the handles, so the compiler can vectorize them
+static int arith_all_imm_int(lval** xs, int n) {
+    uint64_t bad = 0;
+    for (int i = 0; i < n; i++) {
+        bad |= ((uint64_t)(uintptr_t)xs[i] >> 48) ^ LVAL_INT_TAG;
+    }
+    return bad == 0;
+}
 
-    if ((strcmp(op, "-") == 0) && a->count == 0) {
-        x->num = -x->num;
+static int64_t arith_sum_imm_int(lval** xs, int n) {
+    int64_t s = 0;
+    for (int i = 0; i < n; i++) {
+        s += (int64_t)((uint64_t)(uintptr_t)xs[i] << 16) >> 16;
     }
+    return s;
+}
+
+//Folds the operands left to right, exact while they are integers and
+//nothing overflows. The operands must be numbers.
+static lval* arith_fold(lval* a, const arith_op* op) {
+    lval** xs = a->cell;
+    int n = a->count;
+
+    int exact = lval_type(xs[0]) == LVAL_INT;
+    int64_t acc = exact ? lval_get_int(xs[0]) : 0;
+    double x = lval_to_double(xs[0]);
 
-    while (a->count > 0) {
-        lval* y = lval_pop(a, 0);
+    if (op == &arith_sub && n == 1) {
+        exact = exact && sub_exact(0, acc, &acc);
+        x = -x;
+    }
 
-        if (strcmp(op, "+") == 0) {x->num += y->num;}
-        if (strcmp(op, "-") == 0) {x->num -= y->num;}
-        if (strcmp(op, "*") == 0) {x->num *= y->num;}
-        if (strcmp(op, "/") == 0) {
-            if (y->num == 0) {
-                lval_del(x); lval_del(y);
-                x = lval_err("Division by zero"); break;
+    int i = 1;
+    int scalar_end = 1;
+    while (exact && i < n) {
+        //Sum whole blocks of immediate integers at once where possible
+        if (op->sign && i >= scalar_end) {
+            int m = n - i < ARITH_BLOCK ? n - i : ARITH_BLOCK;
+            if (acc > -ARITH_BLOCK_LIMIT && acc < ARITH_BLOCK_LIMIT &&
+                arith_all_imm_int(xs + i, m)) {
+                acc += op->sign * arith_sum_imm_int(xs + i, m);
+                i += m;
+                continue;
             }
-            x->num /= y->num;
+            scalar_end = i + m;
         }
-        if (strcmp(op, "%") == 0) {
-            if (is_int(x->num) && is_int(y->num)) {
-                x->num = (double)((int) x->num % (int) y->num);
-            } else {
-                return lval_err("Modulo works only on integers, got x=%f and y=%f.", x->num, y->num);
-            }
+
+        if (op->divides && lval_to_double(xs[i]) == 0) {
+            lval_del(a);
+            return lval_err("Division by zero");
+        }
+
+        int64_t r;
+        if (lval_type(xs[i]) != LVAL_INT || !op->exact(acc, lval_get_int(xs[i]), &r)) {
+            x = (double)acc;
+            exact = 0;
+            break;
         }
-        lval_del(y);
+        acc = r;
+        i++;
     }
-    lval_del(a); return(x);
+
+    for (; i < n; i++) {
+        double y = lval_to_double(xs[i]);
+        if (op->divides && y == 0) {
+            lval_del(a);
+            return lval_err("Division by zero");
+        }
+
+        lval* err = op->inexact(&x, y);
+        if (err) {
+            lval_del(a);
+            return err;
+        }
+    }
+
+    lval_del(a);
+    return exact ? lval_int(acc) : lval_num(x);
+}
+
+static lval* builtin_op(lenv* e, lval* a, const arith_op* op) {
+    for (int i=0; i < a->count; i++) {
+        LASSERT_NUMBER(a, "op", i)
+    }
+
+    return arith_fold(a, op);
 }
 
 lval* builtin_add(lenv* e, lval* a) {
-    return builtin_op(e, a, "+");
+    return builtin_op(e, a, &arith_add);
 }
 
 lval* builtin_sub(lenv* e, lval* a) {
-    return builtin_op(e, a, "-");
+    return builtin_op(e, a, &arith_sub);
 }
 
 lval* builtin_mul(lenv* e, lval* a) {
-    return builtin_op(e, a, "*");
+    return builtin_op(e, a, &arith_mul);
 }
 
 lval* builtin_div(lenv* e, lval* a) {
-    return builtin_op(e, a, "/");
+    return builtin_op(e, a, &arith_div);
 }
 
 lval* builtin_mod(lenv* e, lval* a) {
-    return builtin_op(e, a, "%");
+    return builtin_op(e, a, &arith_mod);
+}
+
+/*
+ * Entry points for calls whose arguments were proven to match the signature
+ * of the builtin when they were compiled. They skip the checks the signature
+ * covers, checks that depend on the values themselves remain.
+ */
+static lval* builtin_add_unchecked(lenv* e, lval* a) {
+    return arith_fold(a, &arith_add);
+}
+
+static lval* builtin_sub_unchecked(lenv* e, lval* a) {
+    return arith_fold(a, &arith_sub);
+}
+
+static lval* builtin_mul_unchecked(lenv* e, lval* a) {
+    return arith_fold(a, &arith_mul);
+}
+
+static lval* builtin_div_unchecked(lenv* e, lval* a) {
+    return arith_fold(a, &arith_div);
+}
+
+static lval* builtin_mod_unchecked(lenv* e, lval* a) {
+    return arith_fold(a, &arith_mod);
+}
+
+static lval* builtin_head_unchecked(lenv* e, lval* a) {
+    LASSERT_ELIST(a, "head", 0);
+
+    return lval_slice(lval_take(a, 0), 0, 1);
+}
+
+static lval* builtin_tail_unchecked(lenv* e, lval* a) {
+    LASSERT_ELIST(a, "tail", 0);
+
+    lval* v = lval_take(a, 0);
+    return lval_slice(v, 1, v->count - 1);
+}
+
+static lval* builtin_eval_unchecked(lenv* e, lval* a) {
+    return lvm_enter(e, lval_take(a, 0));
+}
+
+static lval* builtin_join_unchecked(lenv* e, lval* a) {
+    lval* x = lval_pop(a, 0);
+
+    while (a->count) {
+        x = lval_join(x, lval_pop(a, 0));
+    }
+
+    lval_del(a);
+    return x;
 }
 
 lval* builtin_head(lenv* e, lval* a) {
     LASSERT_ONEARG(a, "head", 1);
     LASSERT_TYPE(a, "head", 0, LVAL_QEXPR);
-    LASSERT_ELIST(a, "head", 0);
 
-    lval* v = lval_take(a, 0);
-    while (v->count > 1) {lval_del(lval_pop(v, 1));}
-    return v;
+    return builtin_head_unchecked(e, a);
 }
 
 lval* builtin_tail(lenv* e, lval* a) {
     LASSERT_ONEARG(a, "tail", 1);
     LASSERT_TYPE(a, "tail", 0, LVAL_QEXPR);
-    LASSERT_ELIST(a, "tail", 0);
 
-    lval*  v= lval_take(a, 0);
-    lval_del(lval_pop(v, 0));
-    return v;
+    return builtin_tail_unchecked(e, a);
 }
 
 lval* builtin_list(lenv* e, lval* a) {
@@ -114,24 +307,15 @@ lval* builtin_eval(lenv* e, lval* a) {
     LASSERT_ONEARG(a, "eval", 1);
     LASSERT_TYPE(a, "eval", 0, LVAL_QEXPR);
 
-    lval* x = lval_take(a, 0);
-    x->type = LVAL_SEXPR;
-    return lval_eval(e, x);
+    return builtin_eval_unchecked(e, a);
 }
 
 lval* builtin_join(lenv* e, lval* a) {
     for (int i = 0; i < a->count; i++) {
-        LASSERT_TYPE(a, "join", 0, LVAL_QEXPR);
-    }
-
-    lval* x = lval_pop(a, 0);
-
-    while (a->count) {
-        x = lval_join(x, lval_pop(a, 0));
+        LASSERT_TYPE(a, "join", i, LVAL_QEXPR);
     }
 
-    lval_del(a);
-    return x;
+    return builtin_join_unchecked(e, a);
 }
 
 lval* builtin_def(lenv* e, lval* a) {
@@ -140,58 +324,210 @@ lval* builtin_def(lenv* e, lval* a) {
     lval* syms = a->cell[0];
 
     for (int i=0; i < syms->count; i ++) {
-        LASSERT(a, (syms->cell[i]->type == LVAL_SYM),
+        LASSERT(a, (lval_type(syms->cell[i]) == LVAL_SYM),
                 "Function 'def' cannot define non-symbol. Got %s and expected %s.",
-                ltype_name(syms->cell[i]->type), ltype_name(LVAL_SYM));
+                ltype_name(lval_type(syms->cell[i])), ltype_name(LVAL_SYM));
     }
 
     LASSERT(a, syms->count == a->count-1,
             "Function def cannot define incorrect number of values to symbols.");
 
     for (int i=0; i < syms->count; i++) {
-        lenv_put(e, syms->cell[i], a->cell[i+1]);
+        lenv_def(e, syms->cell[i], a->cell[i+1]);
     }
 
     lval_del(a);
     return lval_sexpr();
 }
 
-lval* lval_eval(lenv* e, lval* v) {
-    if (v->type == LVAL_SYM) {
-        lval* x = lenv_get(e, v);
-        lval_del(v);
-        return x;
+lval* builtin_let(lenv* e, lval* a) {
+    LASSERT(a, a->count >= 2,
+            "Function 'let' passed too few arguments! Got %i, expected at least 2.",
+            a->count);
+    LASSERT_TYPE(a, "let", 0, LVAL_QEXPR);
+    LASSERT_TYPE(a, "let", a->count-1, LVAL_QEXPR);
+
+    lval* syms = a->cell[0];
+
+    for (int i=0; i < syms->count; i++) {
+        LASSERT(a, (lval_type(syms->cell[i]) == LVAL_SYM),
+                "Function 'let' cannot bind non-symbol. Got %s and expected %s.",
+                ltype_name(lval_type(syms->cell[i])), ltype_name(LVAL_SYM));
     }
 
-    if (v->type == LVAL_SEXPR) {
-        return lval_eval_sexpr(e, v);
+    LASSERT(a, syms->count == a->count-2,
+            "Function let cannot bind incorrect number of values to symbols.");
+
+    lenv* frame = lenv_new_frame(e, syms->count);
+    for (int i=0; i < syms->count; i++) {
+        frame->syms[i] = syms->cell[i]->sym;
+        frame->vals[i] = lval_ref(a->cell[i+1]);
     }
 
-    return v;
+    lval* result = lvm_enter(frame, lval_take(a, a->count-1));
+    lenv_del(frame);
+    return result;
 }
 
-lval* lval_eval_sexpr(lenv* e, lval* v) {
-    for (int i=0; i < v->count; i++) {
-        v->cell[i] = lval_eval(e, v->cell[i]);
+lval* builtin_lambda(lenv* e, lval* a) {
+    LASSERT_ONEARG(a, "\\", 2);
+    LASSERT_TYPE(a, "\\", 0, LVAL_QEXPR);
+    LASSERT_TYPE(a, "\\", 1, LVAL_QEXPR);
+
+    lval* formals = a->cell[0];
+
+    for (int i=0; i < formals->count; i++) {
+        LASSERT(a, (lval_type(formals->cell[i]) == LVAL_SYM),
+                "Cannot define non-symbol. Got %s and expected %s.",
+                ltype_name(lval_type(formals->cell[i])), ltype_name(LVAL_SYM));
+
+        LASSERT(a, strcmp(formals->cell[i]->sym->name, "&") != 0 ||
+                   i == formals->count-2,
+                "Function format invalid. Symbol '&' not followed by single symbol.");
     }
 
-    for (int i=0; i < v->count; i++) {
-        if (v->cell[i]->type == LVAL_ERR) {return lval_take(v, i);}
+    formals = lval_pop(a, 0);
+    lval* body = lval_take(a, 0);
+    lval* f = lval_lambda(e, formals, body);
+
+    //The body is checked as the function is defined
+    lval* err = lcode_compile_lambda(f, e);
+    if (err) {
+        lval_del(f);
+        return err;
     }
+    return f;
+}
 
-    if (v->count == 0) {return v;}
+lval* builtin_mem(lenv* e, lval* a) {
+    LASSERT_ONEARG(a, "mem", 1);
+    LASSERT_TYPE(a, "mem", 0, LVAL_QEXPR);
+    for (int i = 0; i < a->cell[0]->count; i++) {
+        LASSERT(a, lval_is_number(a->cell[0]->cell[i]),
+                "Function 'mem' expects size classes as numbers. Got %s.",
+                ltype_name(lval_type(a->cell[0]->cell[i])));
+    }
 
-    if (v->count == 1) {return lval_take(v, 0);}
+    lmem_class_stats stats[LMEM_CLASSES];
+    lmem_stats(stats);
 
-    lval* f = lval_pop(v, 0);
-    if (f->type != LVAL_FUN) {
-        lval_del(v);
-        lval_del(f);
-        return lval_err("first element is not a function, got '%s'",
-                        ltype_name(f->type));
+    lval* sizes = a->cell[0];
+    lval* x = lval_qexpr();
+    for (int c = 0; c < LMEM_CLASSES; c++) {
+        int wanted = sizes->count == 0;
+        for (int i = 0; i < sizes->count; i++) {
+            if (lval_to_double(sizes->cell[i]) == stats[c].size) {wanted = 1;}
+        }
+        if (!wanted) {continue;}
+
+        lval* row = lval_qexpr();
+        row = lval_add(row, lval_int(stats[c].size));
+        row = lval_add(row, lval_int(stats[c].slabs));
+        row = lval_add(row, lval_int(stats[c].live));
+        row = lval_add(row, lval_int(stats[c].free));
+        x = lval_add(x, row);
     }
 
-    lval* result = f->fun(e, v);
-    lval_del(f);
-    return result;
+    lval_del(a);
+    return x;
+}
+
+static lval* gc_stat(char* name, lval* value) {
+    lval* x = lval_qexpr();
+    x = lval_add(x, lval_sym(name));
+    return lval_add(x, value);
+}
+
+lval* builtin_gc(lenv* e, lval* a) {
+    LASSERT_ONEARG(a, "gc", 1);
+    LASSERT_TYPE(a, "gc", 0, LVAL_QEXPR);
+
+    lval* opts = a->cell[0];
+    int collect = 0;
+    for (int i = 0; i < opts->count; i++) {
+        lval* o = opts->cell[i];
+        LASSERT(a, lval_type(o) == LVAL_SYM,
+                "Function 'gc' expects option names. Got %s.",
+                ltype_name(lval_type(o)));
+
+        if (strcmp(o->sym->name, "collect") == 0) {
+            collect = 1;
+        } else if (strcmp(o->sym->name, "threshold") == 0) {
+            LASSERT(a, i + 1 < opts->count && lval_type(opts->cell[i+1]) == LVAL_INT
+                       && lval_get_int(opts->cell[i+1]) >= 0,
+                    "Function 'gc' option 'threshold' expects a node count.");
+            lgc_set_min_threshold((size_t)lval_get_int(opts->cell[++i]));
+        } else {
+            LASSERT(a, 0, "Function 'gc' got unknown option '%s'.", o->sym->name);
+        }
+    }
+
+    //The arguments are not a root, they must not be held while collecting
+    lval_del(a);
+    if (collect) {lgc_collect(e);}
+
+    lgc_stats stats;
+    lgc_get_stats(&stats);
+
+    lval* x = lval_qexpr();
+    x = lval_add(x, gc_stat("collections", lval_int(stats.collections)));
+    x = lval_add(x, gc_stat("live", lval_int(stats.live)));
+    x = lval_add(x, gc_stat("heap", lval_int(stats.heap)));
+    x = lval_add(x, gc_stat("threshold", lval_int(stats.threshold)));
+    x = lval_add(x, gc_stat("freed", lval_int(stats.last_freed)));
+    x = lval_add(x, gc_stat("total-freed", lval_int(stats.total_freed)));
+    x = lval_add(x, gc_stat("pause-ms", lval_num(stats.last_pause_ms)));
+    x = lval_add(x, gc_stat("total-pause-ms", lval_num(stats.total_pause_ms)));
+    return x;
+}
+
+//Files are named by a single symbol, as in {data/points}
+static char* builtin_path(lval* a) {
+    lval* x = a->cell[0];
+    if (lval_type(x) != LVAL_QEXPR || x->count != 1 || lval_type(x->cell[0]) != LVAL_SYM) {
+        return NULL;
+    }
+    return x->cell[0]->sym->name;
+}
+
+lval* builtin_save(lenv* e, lval* a) {
+    LASSERT_ONEARG(a, "save", 2);
+    char* path = builtin_path(a);
+    LASSERT(a, path, "Function 'save' expects the file name as a single symbol.");
+
+    lval* err = lbin_save(path, a->cell[1]);
+    lval_del(a);
+    return err ? err : lval_sexpr();
+}
+
+lval* builtin_load(lenv* e, lval* a) {
+    LASSERT_ONEARG(a, "load", 1);
+    char* path = builtin_path(a);
+    LASSERT(a, path, "Function 'load' expects the file name as a single symbol.");
+
+    lval* x = lbin_load(path);
+    lval_del(a);
+    return x;
+}
+
+//LVAL_NUM stands for any number, -1 for any type or number of arguments
+static const lsig sigs[] = {
+    {builtin_list, NULL, "list", -1, -1, LVAL_QEXPR},
+    {builtin_head, builtin_head_unchecked, "head", 1, LVAL_QEXPR, LVAL_QEXPR},
+    {builtin_tail, builtin_tail_unchecked, "tail", 1, LVAL_QEXPR, LVAL_QEXPR},
+    {builtin_eval, builtin_eval_unchecked, "eval", 1, LVAL_QEXPR, -1},
+    {builtin_join, builtin_join_unchecked, "join", -1, LVAL_QEXPR, LVAL_QEXPR},
+    {builtin_add, builtin_add_unchecked, "op", -1, LVAL_NUM, LVAL_NUM},
+    {builtin_sub, builtin_sub_unchecked, "op", -1, LVAL_NUM, LVAL_NUM},
+    {builtin_mul, builtin_mul_unchecked, "op", -1, LVAL_NUM, LVAL_NUM},
+    {builtin_div, builtin_div_unchecked, "op", -1, LVAL_NUM, LVAL_NUM},
+    {builtin_mod, builtin_mod_unchecked, "op", -1, LVAL_NUM, LVAL_NUM},
+    {builtin_lambda, NULL, "\\", 2, LVAL_QEXPR, LVAL_LAMBDA},
+};
+
+const lsig* builtin_sig(lbuiltin fun) {
+    for (size_t i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++) {
+        if (sigs[i].fun == fun) {return &sigs[i];}
+    }
+    return NULL;
 }
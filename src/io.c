@@ -1,10 +1,22 @@
 #include "../include/io.h"
+#include "../include/lsym.h"
+
+lval* lval_read_number(char* s) {
+    //Integral literals are exact, unless they do not fit into 64 bits
+    if (strchr(s, '.') == NULL) {
+        errno = 0;
+        long long n = strtoll(s, NULL, 10);
+        if (errno != ERANGE) {return lval_int(n);}
+    }
 
-lval* lval_read_num(mpc_ast_t* t) {
     errno = 0;
-    double x = strtod(t->contents, NULL);
+    double x = strtod(s, NULL);
     return errno != ERANGE ? lval_num(x) :
-           lval_err("Invalid number '%s'", t->contents);
+           lval_err("Invalid number '%s'", s);
+}
+
+lval* lval_read_num(mpc_ast_t* t) {
+    return lval_read_number(t->contents);
 }
 
 lval* lval_read(mpc_ast_t* t) {
@@ -38,45 +50,71 @@ lval* lval_read(mpc_ast_t* t) {
     return x;
 }
 
-void lval_print(lval* v);
+static lwriter* lval_stdout = NULL;
 
-void lval_expr_print(lval* v, char open, char close) {
-    putchar(open);
+static void lval_write_expr(lwriter* w, lval* v, char open, char close) {
+    lwriter_putc(w, open);
     for (int i = 0; i < v->count; i++) {
-        lval_print(v->cell[i]);
+        lval_write(w, v->cell[i]);
 
         if (i != (v->count - 1)) {
-            putchar(' ');
+            lwriter_putc(w, ' ');
         }
     }
-    putchar(close);
+    lwriter_putc(w, close);
 }
 
-void lval_print(lval* v) {
-    int prec = (ceilf(v->num) == v->num) ? 0 : 2;
-    switch (v->type) {
+void lval_write(lwriter* w, lval* v) {
+    switch (lval_type(v)) {
         case LVAL_FUN:
-            printf("<function>");
+            lwriter_puts(w, "<function>");
+            break;
+        case LVAL_LAMBDA:
+            lwriter_puts(w, "(\\ ");
+            lval_write(w, v->lambda->formals);
+            lwriter_putc(w, ' ');
+            lval_write(w, v->lambda->body);
+            lwriter_putc(w, ')');
             break;
-        case LVAL_NUM:
-            printf("%.*f", prec, v->num);
+        case LVAL_NUM: {
+            double num = lval_get_num(v);
+            int prec = (floor(num) == num) ? 0 : 2;
+            lwriter_fixed(w, num, prec);
+            break;
+        }
+        case LVAL_INT:
+            lwriter_int(w, lval_get_int(v));
             break;
         case LVAL_ERR:
-            printf("Error %s", v->err);
+            lwriter_puts(w, "Error ");
+            lwriter_puts(w, v->err);
             break;
         case LVAL_SYM:
-            printf("%s", v->sym);
+            lwriter_puts(w, v->sym->name);
             break;
         case LVAL_SEXPR:
-            lval_expr_print(v, '(', ')');
+            lval_write_expr(w, v, '(', ')');
             break;
         case LVAL_QEXPR:
-            lval_expr_print(v, '{', '}');
+            lval_write_expr(w, v, '{', '}');
             break;
     }
 }
 
+void lval_print(lval* v) {
+    if (lval_stdout == NULL) {lval_stdout = lwriter_file(stdout);}
+    lval_write(lval_stdout, v);
+    lwriter_flush(lval_stdout);
+}
+
 void lval_println(lval* v) {
-    lval_print(v);
-    putchar('\n');
-}
\ No newline at end of file
+    if (lval_stdout == NULL) {lval_stdout = lwriter_file(stdout);}
+    lval_write(lval_stdout, v);
+    lwriter_putc(lval_stdout, '\n');
+    lwriter_flush(lval_stdout);
+}
+
+void lval_print_cleanup(void) {
+    if (lval_stdout) {lwriter_del(lval_stdout);}
+    lval_stdout = NULL;
+}
@@ -0,0 +1,342 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "../include/lbin.h"
+#include "../include/lsym.h"
+
+/*
+ * The encoder numbers the symbols of a value in a first pass, in the order
+ * they are met, with an open addressing table keyed on the interned lsym.
+ */
+typedef struct {
+    lsym** keys;
+    size_t* index;
+    size_t capacity;
+    lsym** syms;
+    size_t count;
+} lbin_symbols;
+
+static size_t lbin_slot(lbin_symbols* t, lsym* k) {
+    size_t mask = t->capacity - 1;
+    size_t i = ((uintptr_t)k >> 3) * 0x9e3779b97f4a7c15u & mask;
+    while (t->keys[i] && t->keys[i] != k) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static void lbin_number(lbin_symbols* t, lsym* k) {
+    if (t->count && t->keys[lbin_slot(t, k)] == k) {return;}
+
+    if ((t->count + 1) * 2 > t->capacity) {
+        size_t old_capacity = t->capacity;
+        lsym** old_keys = t->keys;
+        size_t* old_index = t->index;
+
+        t->capacity = old_capacity ? old_capacity * 2 : 64;
+        t->keys = calloc(t->capacity, sizeof(lsym*));
+        t->index = malloc(t->capacity * sizeof(size_t));
+        t->syms = realloc(t->syms, t->capacity / 2 * sizeof(lsym*));
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old_keys[i]) {
+                size_t j = lbin_slot(t, old_keys[i]);
+                t->keys[j] = old_keys[i];
+                t->index[j] = old_index[i];
+            }
+        }
+        free(old_keys);
+        free(old_index);
+    }
+
+    size_t i = lbin_slot(t, k);
+    t->keys[i] = k;
+    t->index[i] = t->count;
+    t->syms[t->count++] = k;
+}
+
+//Numbers the symbols in v, fails on the first function
+static lval* lbin_collect(lbin_symbols* t, lval* v) {
+    switch (lval_type(v)) {
+        case LVAL_FUN:
+        case LVAL_LAMBDA:
+            return lval_err("Cannot save a function!");
+        case LVAL_SYM:
+            lbin_number(t, v->sym);
+            break;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            for (int i = 0; i < v->count; i++) {
+                lval* err = lbin_collect(t, v->cell[i]);
+                if (err) {return err;}
+            }
+            break;
+    }
+    return NULL;
+}
+
+static void lbin_varint(lwriter* w, uint64_t x) {
+    char buffer[10];
+    int n = 0;
+    while (x >= 0x80) {
+        buffer[n++] = (char)(x | 0x80);
+        x >>= 7;
+    }
+    buffer[n++] = (char)x;
+    lwriter_put(w, buffer, n);
+}
+
+static void lbin_bytes(lwriter* w, const char* s) {
+    size_t n = strlen(s);
+    lbin_varint(w, n);
+    lwriter_put(w, s, n);
+}
+
+static void lbin_value(lwriter* w, lbin_symbols* t, lval* v) {
+    switch (lval_type(v)) {
+        case LVAL_NUM: {
+            double x = lval_get_num(v);
+            uint64_t bits;
+            memcpy(&bits, &x, sizeof(bits));
+            char buffer[9];
+            buffer[0] = LBIN_NUM;
+            for (int i = 0; i < 8; i++) {buffer[i + 1] = (char)(bits >> (8 * i));}
+            lwriter_put(w, buffer, sizeof(buffer));
+            break;
+        }
+        case LVAL_INT: {
+            int64_t x = lval_get_int(v);
+            lwriter_putc(w, LBIN_INT);
+            lbin_varint(w, ((uint64_t)x << 1) ^ (uint64_t)(x >> 63));
+            break;
+        }
+        case LVAL_ERR:
+            lwriter_putc(w, LBIN_ERR);
+            lbin_bytes(w, v->err);
+            break;
+        case LVAL_SYM:
+            lwriter_putc(w, LBIN_SYM);
+            lbin_varint(w, t->index[lbin_slot(t, v->sym)]);
+            break;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            lwriter_putc(w, lval_type(v) == LVAL_SEXPR ? LBIN_SEXPR : LBIN_QEXPR);
+            lbin_varint(w, (uint64_t)v->count);
+            for (int i = 0; i < v->count; i++) {
+                lbin_value(w, t, v->cell[i]);
+            }
+            break;
+    }
+}
+
+lval* lbin_encode(lwriter* w, lval* v) {
+    lbin_symbols t = {NULL, NULL, 0, NULL, 0};
+    lval* err = lbin_collect(&t, v);
+
+    if (err == NULL) {
+        lwriter_put(w, LBIN_MAGIC, 4);
+        lwriter_putc(w, LBIN_VERSION);
+        lbin_varint(w, t.count);
+        for (size_t i = 0; i < t.count; i++) {
+            lbin_bytes(w, t.syms[i]->name);
+        }
+        lbin_value(w, &t, v);
+    }
+
+    free(t.keys);
+    free(t.index);
+    free(t.syms);
+    return err;
+}
+
+lval* lbin_save(const char* path, lval* v) {
+#ifdef _WIN32
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) {return lval_err("Cannot save to '%s': %s", path, strerror(errno));}
+    lwriter* w = lwriter_file(f);
+#else
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {return lval_err("Cannot save to '%s': %s", path, strerror(errno));}
+    lwriter* w = lwriter_fd(fd);
+#endif
+
+    lval* err = lbin_encode(w, v);
+    if (lwriter_flush(w) != 0 && err == NULL) {
+        err = lval_err("Cannot save to '%s': %s", path, strerror(errno));
+    }
+    lwriter_del(w);
+#ifdef _WIN32
+    if (fclose(f) != 0 && err == NULL) {
+        err = lval_err("Cannot save to '%s': %s", path, strerror(errno));
+    }
+#else
+    close(fd);
+#endif
+    return err;
+}
+
+typedef struct {
+    const unsigned char* p;
+    const unsigned char* end;
+    lval** syms;
+    uint64_t sym_count;
+} lbin_reader;
+
+static int lbin_read_varint(lbin_reader* r, uint64_t* x) {
+    *x = 0;
+    for (int shift = 0; shift < 64 && r->p < r->end; shift += 7) {
+        unsigned char c = *r->p++;
+        *x |= (uint64_t)(c & 0x7f) << shift;
+        if (c < 0x80) {return 1;}
+    }
+    return 0;
+}
+
+//NULL if the data ends before the value does
+static lval* lbin_read_value(lbin_reader* r) {
+    if (r->p == r->end) {return NULL;}
+
+    uint64_t n;
+    switch (*r->p++) {
+        case LBIN_NUM: {
+            if (r->end - r->p < 8) {return NULL;}
+            uint64_t bits = 0;
+            for (int i = 0; i < 8; i++) {bits |= (uint64_t)r->p[i] << (8 * i);}
+            r->p += 8;
+            double x;
+            memcpy(&x, &bits, sizeof(x));
+            return lval_num(x);
+        }
+        case LBIN_INT:
+            if (!lbin_read_varint(r, &n)) {return NULL;}
+            return lval_int((int64_t)(n >> 1) ^ -(int64_t)(n & 1));
+        case LBIN_ERR:
+            if (!lbin_read_varint(r, &n) || n > (uint64_t)(r->end - r->p)) {return NULL;}
+            r->p += n;
+            return lval_err("%.*s", (int)n, (const char*)r->p - n);
+        case LBIN_SYM:
+            if (!lbin_read_varint(r, &n) || n >= r->sym_count) {return NULL;}
+            return lval_ref(r->syms[n]);
+        case LBIN_SEXPR:
+        case LBIN_QEXPR: {
+            int sexpr = r->p[-1] == LBIN_SEXPR;
+            //Every item takes at least a byte
+            if (!lbin_read_varint(r, &n) || n > (uint64_t)(r->end - r->p) || n > INT_MAX) {
+                return NULL;
+            }
+            lval* x = sexpr ? lval_sexpr() : lval_qexpr();
+            if (n == 0) {return x;}
+
+            x = lval_reserve(x, (int)n);
+            for (uint64_t i = 0; i < n; i++) {
+                lval* y = lbin_read_value(r);
+                if (y == NULL) {
+                    lval_vec(x)->len = x->count;
+                    lval_del(x);
+                    return NULL;
+                }
+                x->cell[x->count++] = y;
+            }
+            lval_vec(x)->len = x->count;
+            return x;
+        }
+    }
+    return NULL;
+}
+
+lval* lbin_decode(const char* data, size_t n) {
+    lbin_reader r = {(const unsigned char*)data, (const unsigned char*)data + n, NULL, 0};
+    if (n < 5 || memcmp(data, LBIN_MAGIC, 4) != 0) {
+        return lval_err("Not a saved value!");
+    }
+    if (data[4] != LBIN_VERSION) {
+        return lval_err("Saved value has version %i, expected %i.", data[4], LBIN_VERSION);
+    }
+    r.p += 5;
+
+    lval* x = NULL;
+    uint64_t count;
+    if (lbin_read_varint(&r, &count) && count <= (uint64_t)(r.end - r.p)) {
+        r.syms = malloc(sizeof(lval*) * (count ? count : 1));
+        char buffer[256];
+        for (; r.sym_count < count; r.sym_count++) {
+            uint64_t len;
+            if (!lbin_read_varint(&r, &len) || len > (uint64_t)(r.end - r.p)) {break;}
+            char* s = len < sizeof(buffer) ? buffer : malloc(len + 1);
+            memcpy(s, r.p, len);
+            s[len] = '\0';
+            r.syms[r.sym_count] = lval_sym(s);
+            if (s != buffer) {free(s);}
+            r.p += len;
+        }
+        if (r.sym_count == count) {x = lbin_read_value(&r);}
+    }
+
+    for (uint64_t i = 0; i < r.sym_count; i++) {
+        lval_del(r.syms[i]);
+    }
+    free(r.syms);
+
+    if (x && r.p != r.end) {
+        lval_del(x);
+        x = NULL;
+    }
+    return x ? x : lval_err("Saved value is corrupt!");
+}
+
+#ifdef _WIN32
+//There is no mmap, the file is read into memory instead
+lval* lbin_load(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {return lval_err("Cannot load '%s': %s", path, strerror(errno));}
+
+    size_t len = 0;
+    size_t capacity = 64 * 1024;
+    char* data = malloc(capacity);
+    size_t n;
+    while ((n = fread(data + len, 1, capacity - len, f)) > 0) {
+        len += n;
+        if (len == capacity) {
+            capacity *= 2;
+            data = realloc(data, capacity);
+        }
+    }
+
+    lval* x = ferror(f) ? lval_err("Cannot load '%s': %s", path, strerror(errno))
+                        : lbin_decode(data, len);
+    fclose(f);
+    free(data);
+    return x;
+}
+#else
+lval* lbin_load(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {return lval_err("Cannot load '%s': %s", path, strerror(errno));}
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        lval* err = lval_err("Cannot load '%s': %s", path, strerror(errno));
+        close(fd);
+        return err;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return lbin_decode("", 0);
+    }
+
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {return lval_err("Cannot load '%s': %s", path, strerror(errno));}
+
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+    lval* x = lbin_decode(data, (size_t)st.st_size);
+    munmap(data, (size_t)st.st_size);
+    return x;
+}
+#endif
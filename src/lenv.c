@@ -1,18 +1,64 @@
 #include "../include/lenv.h"
 #include "../include/builtins.h"
+#include "../include/lmem.h"
+
+#define LENV_MIN_CAPACITY 16
+
+uint64_t lenv_version = 1;
+uint64_t lenv_builtin_version = 1;
 
 lenv* lenv_new(void) {
     lenv* e = malloc(sizeof(lenv));
+    e->par = NULL;
+    e->refs = 1;
     e->count = 0;
+    e->capacity = 0;
     e->syms = NULL;
     e->vals = NULL;
     return e;
 }
 
+static size_t lenv_frame_size(int count) {
+    return sizeof(lenv) + (sizeof(lsym*) + sizeof(lval*)) * count;
+}
+
+//The caller names the slots and fills in their values, slots left NULL are
+//only a scope to compile against. The slots are allocated together with
+//the frame, so a frame is a single allocation.
+lenv* lenv_new_frame(lenv* par, int count) {
+    lenv* e = lmem_alloc(lenv_frame_size(count));
+    e->par = par->par ? lenv_ref(par) : par;
+    e->refs = 1;
+    e->count = count;
+    e->capacity = 0;
+    e->syms = (lsym**)(e + 1);
+    e->vals = (lval**)(e->syms + count);
+    return e;
+}
+
+//Frames are shared by the functions created in them
+lenv* lenv_ref(lenv* e) {
+    e->refs++;
+    return e;
+}
+
 void lenv_del(lenv* e) {
-    for(int i=0; i < e->count; i++) {
-        lval_del(e->vals[i]);
-        free(e->syms[i]);
+    //Releasing a frame may release the frames around it as well
+    while (e->par) {
+        if (--e->refs > 0) {return;}
+
+        for (int i=0; i < e->count; i++) {
+            if (e->vals[i]) {lval_del(e->vals[i]);}
+        }
+
+        lenv* par = e->par;
+        lmem_free(e, lenv_frame_size(e->count));
+        if (par->par == NULL) {return;}
+        e = par;
+    }
+
+    for(int i=0; i < e->capacity; i++) {
+        if (e->syms[i]) {lval_del(e->vals[i]);}
     }
 
     free(e->syms);
@@ -20,32 +66,95 @@ void lenv_del(lenv* e) {
     free(e);
 }
 
+//Returns the slot holding k, or the empty slot where k would be inserted
+static int lenv_slot(lenv* e, lsym* k) {
+    int mask = e->capacity - 1;
+    int i = k->hash & mask;
+    while (e->syms[i] && e->syms[i] != k) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static void lenv_grow(lenv* e) {
+    int old_capacity = e->capacity;
+    lsym** old_syms = e->syms;
+    lval** old_vals = e->vals;
+
+    e->capacity = old_capacity ? old_capacity * 2 : LENV_MIN_CAPACITY;
+    e->syms = calloc(e->capacity, sizeof(lsym*));
+    e->vals = calloc(e->capacity, sizeof(lval*));
+
+    for (int i=0; i < old_capacity; i++) {
+        if (old_syms[i]) {
+            int j = lenv_slot(e, old_syms[i]);
+            e->syms[j] = old_syms[i];
+            e->vals[j] = old_vals[i];
+        }
+    }
+
+    free(old_syms);
+    free(old_vals);
+}
+
+lenv* lenv_root(lenv* e) {
+    while (e->par) {e = e->par;}
+    return e;
+}
+
+//Slot of k in frame e, later slots shadow earlier ones. -1 if k is not bound.
+int lenv_find(lenv* e, lsym* k) {
+    for (int i = e->count - 1; i >= 0; i--) {
+        if (e->syms[i] == k) {return i;}
+    }
+    return -1;
+}
+
 lval* lenv_get(lenv* e, lval* k) {
-    for (int i=0; i < e->count; i++) {
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            return lval_copy(e->vals[i]);
+    for (; e->par; e = e->par) {
+        int i = lenv_find(e, k->sym);
+        if (i >= 0) {return lval_ref(e->vals[i]);}
+    }
+
+    if (e->count > 0) {
+        int i = lenv_slot(e, k->sym);
+        if (e->syms[i]) {
+            return lval_ref(e->vals[i]);
         }
     }
 
-    return lval_err("Unbound symbol '%s'!", k->sym);
+    return lval_err("Unbound symbol '%s'!", k->sym->name);
 }
 
+//Binds k in the global scope e. The value outlives the current evaluation,
+//so it is moved out of the arena. Frame slots are only filled in when the
+//frame is created.
 void lenv_put(lenv* e, lval* k, lval* v) {
-    for (int i=0; i < e->count; i++) {
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            lval_del(e->vals[i]);
-            e->vals[i] = lval_copy(v);
-            return;
-        }
+    lenv_version++;
+
+    if (e->capacity == 0) {lenv_grow(e);}
+
+    int i = lenv_slot(e, k->sym);
+    if (e->syms[i]) {
+        if (lval_type(e->vals[i]) == LVAL_FUN) {lenv_builtin_version++;}
+        lval_del(e->vals[i]);
+        e->vals[i] = lval_promote(v);
+        return;
+    }
+
+    //Only a new key can push the load factor over one half
+    if ((e->count + 1) * 2 > e->capacity) {
+        lenv_grow(e);
+        i = lenv_slot(e, k->sym);
     }
 
     e->count++;
-    e->vals = realloc(e->vals, sizeof(lval*) * e->count);
-    e->syms = realloc(e->syms, sizeof(char*) * e->count);
+    e->syms[i] = k->sym;
+    e->vals[i] = lval_promote(v);
+}
 
-    e->vals[e->count-1] = lval_copy(v);
-    e->syms[e->count-1] = malloc(strlen(k->sym)+1);
-    strcpy(e->syms[e->count-1], k->sym);
+void lenv_def(lenv* e, lval* k, lval* v) {
+    lenv_put(lenv_root(e), k, v);
 }
 
 void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
@@ -58,6 +167,8 @@ void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
 
 void lenv_add_builtins(lenv* e) {
     lenv_add_builtin(e, "def", builtin_def);
+    lenv_add_builtin(e, "let", builtin_let);
+    lenv_add_builtin(e, "\\", builtin_lambda);
     lenv_add_builtin(e, "list", builtin_list);
     lenv_add_builtin(e, "head", builtin_head);
     lenv_add_builtin(e, "tail", builtin_tail);
@@ -68,4 +179,8 @@ void lenv_add_builtins(lenv* e) {
     lenv_add_builtin(e, "*", builtin_mul);
     lenv_add_builtin(e, "/", builtin_div);
     lenv_add_builtin(e, "%", builtin_mod);
+    lenv_add_builtin(e, "mem", builtin_mem);
+    lenv_add_builtin(e, "gc", builtin_gc);
+    lenv_add_builtin(e, "save", builtin_save);
+    lenv_add_builtin(e, "load", builtin_load);
 }
@@ -0,0 +1,259 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../include/lgc.h"
+#include "../include/lmem.h"
+#include "../include/lenv.h"
+#include "../include/lvm.h"
+
+//Type tag of a node slot that is on the free list
+#define LGC_FREE 0xff
+
+typedef struct lgc_slab {
+    struct lgc_slab* next;
+    lval nodes[LGC_NODES_PER_SLAB];
+} lgc_slab;
+
+static lgc_slab* slabs = NULL;
+static lval* free_list = NULL;
+static lgc_stats stats = {0, 0, 0, LGC_MIN_THRESHOLD, LGC_MIN_THRESHOLD, 0, 0, 0, 0};
+
+static void lgc_refill(void) {
+    lgc_slab* s = malloc(sizeof(lgc_slab));
+    s->next = slabs;
+    slabs = s;
+
+    //Thread the slots onto the free list through the cell pointer
+    for (int i = LGC_NODES_PER_SLAB - 1; i >= 0; i--) {
+        s->nodes[i].type = LGC_FREE;
+        s->nodes[i].cell = (lval**)free_list;
+        free_list = &s->nodes[i];
+    }
+    stats.heap += LGC_NODES_PER_SLAB;
+}
+
+lval* lgc_alloc(void) {
+    lval* v = lmem_arena_alloc(sizeof(lval));
+    if (v) {
+        v->mark = 0;
+        return v;
+    }
+
+    if (free_list == NULL) {lgc_refill();}
+
+    v = free_list;
+    free_list = (lval*)v->cell;
+    //Spilled over from a full arena, it may point into the arena
+    v->mark = lmem_arena_active() ? LGC_YOUNG : 0;
+    stats.live++;
+    return v;
+}
+
+void lgc_free(lval* v) {
+    if (lmem_in_arena(v)) {
+        lmem_free(v, sizeof(lval));
+        return;
+    }
+
+    v->type = LGC_FREE;
+    v->cell = (lval**)free_list;
+    free_list = v;
+    stats.live--;
+}
+
+static int lgc_has_children(lval* v) {
+    return v->type == LVAL_SEXPR || v->type == LVAL_QEXPR;
+}
+
+//Expressions reference their items through a shared lvec. Each mark bumps
+//the epoch so every lvec is only traced once.
+static uint32_t epoch = 0;
+
+static lvec* lgc_visit(lval* v) {
+    if (!lgc_has_children(v)) {return NULL;}
+
+    lvec* w = lval_vec(v);
+    if (w == NULL || w->mark == epoch) {return NULL;}
+    w->mark = epoch;
+    return w;
+}
+
+//Iterative mark so deeply nested lists cannot overflow the C stack
+static lval** mark_stack = NULL;
+static size_t mark_count = 0;
+static size_t mark_capacity = 0;
+
+//Frames have no mark bit, the ones traced so far are kept in a set
+static lenv** traced_envs = NULL;
+static size_t traced_count = 0;
+static size_t traced_capacity = 0;
+
+static size_t lgc_env_slot(lenv* e) {
+    size_t mask = traced_capacity - 1;
+    size_t i = ((uintptr_t)e >> 3) * 0x9e3779b97f4a7c15u & mask;
+    while (traced_envs[i] && traced_envs[i] != e) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+//Returns 0 if e was traced already
+static int lgc_trace_env(lenv* e) {
+    if (traced_count && traced_envs[lgc_env_slot(e)] == e) {return 0;}
+
+    if ((traced_count + 1) * 2 > traced_capacity) {
+        size_t old_capacity = traced_capacity;
+        lenv** old_envs = traced_envs;
+
+        traced_capacity = old_capacity ? old_capacity * 2 : 64;
+        traced_envs = calloc(traced_capacity, sizeof(lenv*));
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old_envs[i]) {traced_envs[lgc_env_slot(old_envs[i])] = old_envs[i];}
+        }
+        free(old_envs);
+    }
+
+    traced_envs[lgc_env_slot(e)] = e;
+    traced_count++;
+    return 1;
+}
+
+//Nodes in the arena are not part of the heap and are never swept, they are
+//only traced through, as they may reference heap nodes
+void lgc_root(lval* v) {
+    if (lval_is_imm(v)) {return;}
+    if (!lmem_in_arena(v)) {
+        if (v->mark & LGC_MARKED) {return;}
+        v->mark |= LGC_MARKED;
+    }
+
+    if (mark_count == mark_capacity) {
+        mark_capacity = mark_capacity ? mark_capacity * 2 : 256;
+        mark_stack = realloc(mark_stack, sizeof(lval*) * mark_capacity);
+    }
+    mark_stack[mark_count++] = v;
+}
+
+void lgc_root_env(lenv* e) {
+    for (; e && lgc_trace_env(e); e = e->par) {
+        if (e->par) {
+            for (int i = 0; i < e->count; i++) {
+                if (e->vals[i]) {lgc_root(e->vals[i]);}
+            }
+        } else {
+            for (int i = 0; i < e->capacity; i++) {
+                if (e->syms[i]) {lgc_root(e->vals[i]);}
+            }
+        }
+    }
+}
+
+//The cache entries of code reference nothing, their values are kept alive
+//by their bindings
+void lgc_root_code(lcode* c) {
+    if (c == NULL) {return;}
+    for (int i = 0; i < c->const_count; i++) {
+        lgc_root(c->consts[i]);
+    }
+    if (c->error) {lgc_root(c->error);}
+}
+
+static void lgc_mark(void) {
+    while (mark_count > 0) {
+        lval* v = mark_stack[--mark_count];
+        if (v->type == LVAL_LAMBDA) {
+            llambda* l = v->lambda;
+            lgc_root(l->formals);
+            lgc_root(l->body);
+            lgc_root_env(l->env);
+            lgc_root_code(l->code);
+            continue;
+        }
+
+        lvec* w = lgc_visit(v);
+        if (w == NULL) {continue;}
+        for (int i = 0; i < w->len; i++) {
+            lgc_root(w->items[i]);
+        }
+        lgc_root_code(w->code);
+    }
+}
+
+//Far above any real count, so that freeing one unreachable node never
+//frees another that the sweep has yet to get to
+#define LGC_PINNED ((uint32_t)1 << 30)
+
+size_t lgc_collect(lenv* e) {
+    clock_t start = clock();
+
+    epoch++;
+    lgc_root_env(lenv_root(e));
+    lvm_mark_roots();
+    lgc_mark();
+    memset(traced_envs, 0, sizeof(lenv*) * traced_capacity);
+    traced_count = 0;
+
+    //Nothing reachable references an unreachable node, so they can be freed
+    //in any order. Each is freed as if its count dropped to zero, which
+    //releases what it holds of the reachable nodes.
+    for (lgc_slab* s = slabs; s; s = s->next) {
+        for (int i = 0; i < LGC_NODES_PER_SLAB; i++) {
+            lval* v = &s->nodes[i];
+            if (v->type != LGC_FREE && !(v->mark & LGC_MARKED)) {v->refs = LGC_PINNED;}
+        }
+    }
+
+    size_t freed = 0;
+    for (lgc_slab* s = slabs; s; s = s->next) {
+        for (int i = 0; i < LGC_NODES_PER_SLAB; i++) {
+            lval* v = &s->nodes[i];
+            if (v->type == LGC_FREE) {continue;}
+            if (v->mark & LGC_MARKED) {
+                v->mark &= ~LGC_MARKED;
+            } else {
+                v->refs = 1;
+                lval_del(v);
+                freed++;
+            }
+        }
+    }
+
+    double pause = 1000.0 * (double)(clock() - start) / CLOCKS_PER_SEC;
+    stats.collections++;
+    stats.last_freed = freed;
+    stats.total_freed += freed;
+    stats.last_pause_ms = pause;
+    stats.total_pause_ms += pause;
+    stats.threshold = stats.live * 2 > stats.min_threshold ?
+                      stats.live * 2 : stats.min_threshold;
+    return freed;
+}
+
+void lgc_maybe_collect(lenv* e) {
+    if (stats.live >= stats.threshold) {lgc_collect(e);}
+}
+
+void lgc_set_min_threshold(size_t nodes) {
+    stats.min_threshold = nodes;
+    if (stats.threshold < nodes) {stats.threshold = nodes;}
+}
+
+void lgc_get_stats(lgc_stats* out) {
+    *out = stats;
+}
+
+void lgc_cleanup(void) {
+    while (slabs) {
+        lgc_slab* next = slabs->next;
+        free(slabs);
+        slabs = next;
+    }
+    free(mark_stack);
+    mark_stack = NULL;
+    mark_count = mark_capacity = 0;
+    free(traced_envs);
+    traced_envs = NULL;
+    traced_count = traced_capacity = 0;
+    free_list = NULL;
+    stats.live = stats.heap = 0;
+}
@@ -0,0 +1,198 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/lmem.h"
+
+typedef struct lmem_slot {
+    struct lmem_slot* next;
+} lmem_slot;
+
+typedef struct lmem_slab {
+    struct lmem_slab* next;
+} lmem_slab;
+
+typedef struct {
+    lmem_slot* free;
+    char* bump;
+    char* bump_end;
+    size_t slabs;
+    size_t live;
+    size_t free_count;
+} lmem_class;
+
+static lmem_class classes[LMEM_CLASSES];
+static lmem_slab* slabs = NULL;
+
+char* lmem_arena = NULL;
+static char* arena_bump = NULL;
+static int arena_active = 0;
+
+//Arena blocks only need to keep pointers aligned
+static size_t lmem_arena_round(size_t size) {
+    return (size + 7) & ~(size_t)7;
+}
+
+void lmem_arena_open(void) {
+    if (lmem_arena == NULL) {lmem_arena = malloc(LMEM_ARENA_SIZE);}
+    arena_bump = lmem_arena;
+    arena_active = 1;
+}
+
+void lmem_arena_close(void) {
+    arena_bump = lmem_arena;
+    arena_active = 0;
+}
+
+int lmem_arena_active(void) {
+    return arena_active;
+}
+
+int lmem_arena_suspend(void) {
+    int active = arena_active;
+    arena_active = 0;
+    return active;
+}
+
+void lmem_arena_resume(int active) {
+    arena_active = active;
+}
+
+//NULL if the arena is not active or the block does not fit anymore
+void* lmem_arena_alloc(size_t size) {
+    if (!arena_active) {return NULL;}
+
+    size = lmem_arena_round(size);
+    if ((size_t)(lmem_arena + LMEM_ARENA_SIZE - arena_bump) < size) {return NULL;}
+
+    void* p = arena_bump;
+    arena_bump += size;
+    return p;
+}
+
+//Gives the block back if it is the last one handed out
+static void lmem_arena_free(void* p, size_t size) {
+    if ((char*)p + lmem_arena_round(size) == arena_bump) {arena_bump = p;}
+}
+
+static int lmem_class_of(size_t size) {
+    int c = 0;
+    size_t s = LMEM_MIN_SIZE;
+    while (s < size) {
+        s <<= 1;
+        c++;
+    }
+    return c;
+}
+
+static size_t lmem_class_size(int c) {
+    return (size_t)LMEM_MIN_SIZE << c;
+}
+
+static void lmem_refill(lmem_class* k) {
+    lmem_slab* s = malloc(LMEM_SLAB_SIZE);
+    s->next = slabs;
+    slabs = s;
+
+    //Keep the slab header in its own slot so every slot stays aligned
+    k->bump = (char*)s + LMEM_MIN_SIZE;
+    k->bump_end = (char*)s + LMEM_SLAB_SIZE;
+    k->slabs++;
+}
+
+void* lmem_alloc(size_t size) {
+    if (size == 0) {return NULL;}
+    if (arena_active) {
+        void* p = lmem_arena_alloc(size);
+        if (p) {return p;}
+    }
+    if (size > LMEM_MAX_SIZE) {return malloc(size);}
+
+    int c = lmem_class_of(size);
+    lmem_class* k = &classes[c];
+    size_t slot = lmem_class_size(c);
+
+    void* p;
+    if (k->free) {
+        p = k->free;
+        k->free = k->free->next;
+        k->free_count--;
+    } else {
+        if ((size_t)(k->bump_end - k->bump) < slot) {lmem_refill(k);}
+        p = k->bump;
+        k->bump += slot;
+    }
+
+    k->live++;
+    return p;
+}
+
+void lmem_free(void* p, size_t size) {
+    if (p == NULL) {return;}
+    if (lmem_in_arena(p)) {lmem_arena_free(p, size); return;}
+    if (size > LMEM_MAX_SIZE) {free(p); return;}
+
+    lmem_class* k = &classes[lmem_class_of(size)];
+    lmem_slot* s = p;
+    s->next = k->free;
+    k->free = s;
+    k->live--;
+    k->free_count++;
+}
+
+void* lmem_realloc(void* p, size_t old_size, size_t new_size) {
+    if (p == NULL || old_size == 0) {return lmem_alloc(new_size);}
+    if (new_size == 0) {lmem_free(p, old_size); return NULL;}
+
+    if (lmem_in_arena(p)) {
+        //The last block handed out can grow in place
+        size_t end = lmem_arena_round(new_size);
+        if ((char*)p + lmem_arena_round(old_size) == arena_bump &&
+            (size_t)(lmem_arena + LMEM_ARENA_SIZE - (char*)p) >= end) {
+            arena_bump = (char*)p + end;
+            return p;
+        }
+        if (new_size <= old_size) {return p;}
+
+        void* q = lmem_alloc(new_size);
+        memcpy(q, p, old_size);
+        return q;
+    }
+
+    if (old_size > LMEM_MAX_SIZE && new_size > LMEM_MAX_SIZE) {
+        return realloc(p, new_size);
+    }
+
+    //Both sizes fall into the same class, the slot already fits
+    if (old_size <= LMEM_MAX_SIZE && new_size <= LMEM_MAX_SIZE &&
+        lmem_class_of(old_size) == lmem_class_of(new_size)) {
+        return p;
+    }
+
+    void* q = lmem_alloc(new_size);
+    memcpy(q, p, old_size < new_size ? old_size : new_size);
+    lmem_free(p, old_size);
+    return q;
+}
+
+void lmem_stats(lmem_class_stats* stats) {
+    for (int c = 0; c < LMEM_CLASSES; c++) {
+        lmem_class* k = &classes[c];
+        size_t slot = lmem_class_size(c);
+        stats[c].size = slot;
+        stats[c].slabs = k->slabs;
+        stats[c].live = k->live;
+        //Slots never handed out yet count as free as well
+        stats[c].free = k->free_count + (size_t)(k->bump_end - k->bump) / slot;
+    }
+}
+
+void lmem_cleanup(void) {
+    while (slabs) {
+        lmem_slab* next = slabs->next;
+        free(slabs);
+        slabs = next;
+    }
+    memset(classes, 0, sizeof(classes));
+    free(lmem_arena);
+    lmem_arena = arena_bump = NULL;
+    arena_active = 0;
+}
@@ -0,0 +1,67 @@
+#include "../include/lopt.h"
+#include "../include/lenv.h"
+#include "../include/builtins.h"
+
+//Builtins without side effects, whose result only depends on their arguments
+static lbuiltin pure[] = {
+    builtin_list, builtin_head, builtin_tail, builtin_join,
+    builtin_add, builtin_sub, builtin_mul, builtin_div, builtin_mod
+};
+
+//Builtin bound to symbol v in the global scope, NULL if there is none
+static lbuiltin lopt_builtin(lenv* e, lval* v) {
+    lval* f = lenv_get(lenv_root(e), v);
+    lbuiltin fun = lval_type(f) == LVAL_FUN ? f->fun : NULL;
+    lval_del(f);
+    return fun;
+}
+
+static int lopt_pure(lbuiltin fun) {
+    for (size_t i = 0; i < sizeof(pure) / sizeof(pure[0]); i++) {
+        if (pure[i] == fun) {return 1;}
+    }
+    return 0;
+}
+
+static int lopt_constant(lval* v) {
+    int t = lval_type(v);
+    return t == LVAL_NUM || t == LVAL_INT || t == LVAL_QEXPR;
+}
+
+//Result of fun on the arguments args if they are all constants and it
+//succeeds, NULL otherwise. Errors are left to happen at run time. Takes
+//over args.
+static lval* lopt_run(lenv* e, lbuiltin fun, lval* args) {
+    lval* r = NULL;
+    if (fun && lopt_pure(fun)) {
+        int constant = 1;
+        for (int i = 0; i < args->count; i++) {
+            if (!lopt_constant(args->cell[i])) {constant = 0;}
+        }
+        if (constant) {
+            r = fun(e, args);
+            args = NULL;
+        }
+    }
+
+    if (args) {lval_del(args);}
+    if (r && !lopt_constant(r)) {
+        lval_del(r);
+        r = NULL;
+    }
+    return r;
+}
+
+lval* lopt_value(lenv* scope, lval* f, lval* args) {
+    if (lval_type(f) != LVAL_SYM) {
+        lval_del(args);
+        return NULL;
+    }
+    for (lenv* e = scope; e->par; e = e->par) {
+        if (lenv_find(e, f->sym) >= 0) {
+            lval_del(args);
+            return NULL;
+        }
+    }
+    return lopt_run(scope, lopt_builtin(scope, f), args);
+}
@@ -0,0 +1,389 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "../include/lread.h"
+#include "../include/io.h"
+
+#define LREAD_MAX_EXPECTED 16
+#define LREAD_SYMBOL_CHARS \
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_+-*/\\=<>!&%"
+
+//What mpc reports for each part of the grammar that fails to match
+static const char* expect_minus = "'-'";
+static const char* expect_digit = "one of '0123456789'";
+static const char* expect_digits = "one or more of one of '0123456789'";
+static const char* expect_dot = "one of '.'";
+static const char* expect_symbol_char = "one of '" LREAD_SYMBOL_CHARS "'";
+static const char* expect_symbol = "one or more of one of '" LREAD_SYMBOL_CHARS "'";
+static const char* expect_sexpr_open = "'('";
+static const char* expect_sexpr_close = "')'";
+static const char* expect_qexpr_open = "'{'";
+static const char* expect_qexpr_close = "'}'";
+static const char* expect_end = "end of input";
+
+typedef struct {
+    const char* s;
+    //Only set on the second scan, which collects the expectations
+    int track;
+    long err;
+    int expected_count;
+    const char* expected[LREAD_MAX_EXPECTED];
+} lreader;
+
+//Keeps the expectations at the furthest position, in the order they occur
+static void lread_expect(lreader* r, const char* p, const char* what) {
+    if (!r->track) {return;}
+
+    long pos = p - r->s;
+    if (pos < r->err) {return;}
+    if (pos > r->err) {
+        r->err = pos;
+        r->expected_count = 0;
+    }
+    for (int i = 0; i < r->expected_count; i++) {
+        if (r->expected[i] == what) {return;}
+    }
+    r->expected[r->expected_count++] = what;
+}
+
+static int lread_is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static int lread_is_symbol(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || lread_is_digit(c) ||
+           (c != '\0' && strchr("_+-*/\\=<>!&%", c) != NULL);
+}
+
+static int lread_is_blank(char c) {
+    return c == ' ' || c == '\f' || c == '\n' || c == '\r' || c == '\t' || c == '\v';
+}
+
+static const char* lread_blank(const char* p) {
+    while (lread_is_blank(*p)) {p++;}
+    return p;
+}
+
+//Copies the n characters at p into buffer, or into the heap if they do not fit
+static char* lread_text(const char* p, long n, char* buffer, size_t size) {
+    char* s = (size_t)n < size ? buffer : malloc(n + 1);
+    memcpy(s, p, n);
+    s[n] = '\0';
+    return s;
+}
+
+//Powers of ten that are exact as doubles
+static const double lread_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+//number : /-?[0-9]+[.]?[0-9]*/
+static lval* lread_number(lreader* r, const char** at) {
+    const char* p = *at;
+    int negative = *p == '-';
+    if (negative) {
+        p++;
+    } else {
+        lread_expect(r, p, expect_minus);
+    }
+
+    if (!lread_is_digit(*p)) {
+        lread_expect(r, p, expect_digits);
+        return NULL;
+    }
+    //The digits are collected into m while they are matched, up to 19 of
+    //them cannot overflow it
+    uint64_t m = 0;
+    int digits = 0;
+    while (lread_is_digit(*p)) {
+        m = m * 10 + (uint64_t)(*p++ - '0');
+        digits++;
+    }
+    lread_expect(r, p, expect_digit);
+
+    int dot = *p == '.';
+    if (dot) {
+        p++;
+    } else {
+        lread_expect(r, p, expect_dot);
+    }
+    int decimals = 0;
+    while (lread_is_digit(*p)) {
+        m = m * 10 + (uint64_t)(*p++ - '0');
+        decimals++;
+    }
+    lread_expect(r, p, expect_digit);
+    digits += decimals;
+
+    lval* x;
+    if (!dot && digits <= 18) {
+        x = lval_int(negative ? -(int64_t)m : (int64_t)m);
+    } else if (dot && digits <= 19 && m <= ((uint64_t)1 << 53) && decimals <= 22) {
+        //Both m and the power of ten are exact, so the one rounding of the
+        //division gives the same double as strtod
+        double y = (double)m / lread_pow10[decimals];
+        x = lval_num(negative ? -y : y);
+    } else {
+        char buffer[64];
+        char* s = lread_text(*at, p - *at, buffer, sizeof(buffer));
+        x = lval_read_number(s);
+        if (s != buffer) {free(s);}
+    }
+
+    *at = lread_blank(p);
+    return x;
+}
+
+//symbol : /[a-zA-Z0-9_+\-*\/\\=<>!&%]+/
+static lval* lread_symbol(lreader* r, const char** at) {
+    const char* p = *at;
+    if (!lread_is_symbol(*p)) {
+        lread_expect(r, p, expect_symbol);
+        return NULL;
+    }
+    while (lread_is_symbol(*p)) {p++;}
+    lread_expect(r, p, expect_symbol_char);
+
+    char buffer[64];
+    char* s = lread_text(*at, p - *at, buffer, sizeof(buffer));
+    lval* x = lval_sym(s);
+    if (s != buffer) {free(s);}
+
+    *at = lread_blank(p);
+    return x;
+}
+
+static lval* lread_expr(lreader* r, const char** at);
+
+//sexpr : '(' <expr>* ')' and qexpr : '{' <expr>* '}'
+static lval* lread_list(lreader* r, const char** at, lval* x, char open, char close,
+                        const char* expect_open, const char* expect_close) {
+    const char* p = *at;
+    if (*p != open) {
+        lread_expect(r, p, expect_open);
+        lval_del(x);
+        return NULL;
+    }
+    p = lread_blank(p + 1);
+
+    lval* y;
+    while ((y = lread_expr(r, &p))) {
+        x = lval_add(x, y);
+    }
+
+    if (*p != close) {
+        lread_expect(r, p, expect_close);
+        lval_del(x);
+        return NULL;
+    }
+
+    *at = lread_blank(p + 1);
+    return x;
+}
+
+//expr : <number> | <symbol> | <sexpr> | <qexpr>
+static lval* lread_expr(lreader* r, const char** at) {
+    lval* x = lread_number(r, at);
+    if (x == NULL) {x = lread_symbol(r, at);}
+    if (x == NULL) {
+        x = lread_list(r, at, lval_sexpr(), '(', ')', expect_sexpr_open, expect_sexpr_close);
+    }
+    if (x == NULL) {
+        x = lread_list(r, at, lval_qexpr(), '{', '}', expect_qexpr_open, expect_qexpr_close);
+    }
+    return x;
+}
+
+//plisp : /^/ <expr>* /$/
+static lval* lread_all(lreader* r) {
+    const char* p = lread_blank(r->s);
+
+    lval* x = lval_sexpr();
+    lval* y;
+    while ((y = lread_expr(r, &p))) {
+        x = lval_add(x, y);
+    }
+
+    if (*p != '\0') {
+        lread_expect(r, p, expect_end);
+        lval_del(x);
+        return NULL;
+    }
+    return x;
+}
+
+//How mpc shows the character it got
+static const char* lread_received(char c, char* buffer) {
+    switch (c) {
+        case '\a': return "bell";
+        case '\b': return "backspace";
+        case '\f': return "formfeed";
+        case '\r': return "carriage return";
+        case '\v': return "vertical tab";
+        case '\0': return "end of input";
+        case '\n': return "newline";
+        case '\t': return "tab";
+        case ' ': return "space";
+        default:
+            sprintf(buffer, "'%c'", c);
+            return buffer;
+    }
+}
+
+//Advances row and col, the position of p, to the position of end
+static void lread_advance(const char* p, const char* end, int* row, long* col) {
+    for (; p < end; p++) {
+        if (*p == '\n') {
+            (*row)++;
+            *col = 0;
+        } else {
+            (*col)++;
+        }
+    }
+}
+
+//The message for the expectations in r, given the position of from, which
+//comes before them
+static char* lread_error(lreader* r, const char* filename, long from, int row, long col) {
+    lread_advance(r->s + from, r->s + r->err, &row, &col);
+
+    size_t size = strlen(filename) + 128;
+    for (int i = 0; i < r->expected_count; i++) {
+        size += strlen(r->expected[i]) + 4;
+    }
+
+    char* msg = malloc(size);
+    int n = sprintf(msg, "%s:%i:%li: error: expected ", filename, row + 1, col + 1);
+    for (int i = 0; i < r->expected_count; i++) {
+        const char* sep = i == 0 ? "" : i == r->expected_count - 1 ? " or " : ", ";
+        n += sprintf(msg + n, "%s%s", sep, r->expected[i]);
+    }
+
+    char buffer[4];
+    sprintf(msg + n, " at %s\n", lread_received(r->s[r->err], buffer));
+    return msg;
+}
+
+lval* lread_string(const char* filename, const char* s, char** err) {
+    lreader r;
+    r.s = s;
+    r.track = 0;
+    r.err = -1;
+    r.expected_count = 0;
+
+    lval* x = lread_all(&r);
+    if (x) {return x;}
+
+    r.track = 1;
+    lread_all(&r);
+    *err = lread_error(&r, filename, 0, 0, 0);
+    return NULL;
+}
+
+lstream* lstream_new(FILE* file, const char* filename) {
+    lstream* s = malloc(sizeof(lstream));
+    s->file = file;
+    s->filename = malloc(strlen(filename) + 1);
+    strcpy(s->filename, filename);
+    s->capacity = LREAD_CHUNK;
+    s->buf = malloc(s->capacity);
+    s->buf[0] = '\0';
+    s->len = 0;
+    s->pos = 0;
+    s->eof = 0;
+    s->pos_row = 0;
+    s->pos_col = 0;
+    s->tail = -1;
+    s->row = 0;
+    s->col = 0;
+    return s;
+}
+
+void lstream_del(lstream* s) {
+    free(s->filename);
+    free(s->buf);
+    free(s);
+}
+
+//Reads more of the input. What was read before pos is dropped, unless the
+//last form is still needed for its tail. Grows the buffer if it is full.
+static void lstream_fill(lstream* s) {
+    size_t keep = s->tail >= 0 ? (size_t)s->tail : s->pos;
+    if (keep > 0) {
+        memmove(s->buf, s->buf + keep, s->len - keep);
+        s->len -= keep;
+        s->pos -= keep;
+        if (s->tail >= 0) {s->tail = 0;}
+    }
+    if (s->capacity - s->len < s->capacity / 2) {
+        s->capacity *= 2;
+        s->buf = realloc(s->buf, s->capacity);
+    }
+
+    size_t n = fread(s->buf + s->len, 1, s->capacity - s->len - 1, s->file);
+    if (n == 0) {s->eof = 1;}
+    s->len += n;
+    s->buf[s->len] = '\0';
+}
+
+//Moves pos forward to p, keeping track of its position
+static void lstream_move(lstream* s, const char* p) {
+    lread_advance(s->buf + s->pos, p, &s->pos_row, &s->pos_col);
+    s->pos = p - s->buf;
+}
+
+lval* lstream_read(lstream* s, char** err) {
+    *err = NULL;
+
+    while (1) {
+        const char* start = lread_blank(s->buf + s->pos);
+        if (start != s->buf + s->pos) {s->tail = -1;}
+        lstream_move(s, start);
+
+        const char* end = s->buf + s->len;
+        if (start == end) {
+            if (s->eof) {return NULL;}
+            lstream_fill(s);
+            continue;
+        }
+
+        lreader r;
+        r.s = s->buf;
+        r.track = 0;
+        r.err = -1;
+        r.expected_count = 0;
+
+        //A form that reaches the end of what is buffered may go on after it
+        const char* p = start;
+        lval* x = lread_expr(&r, &p);
+        if (x && (p < end || s->eof)) {
+            s->row = s->pos_row + 1;
+            s->col = s->pos_col + 1;
+            int atom = lval_type(x) != LVAL_SEXPR && lval_type(x) != LVAL_QEXPR;
+            s->tail = atom && !lread_is_blank(p[-1]) ? (long)s->pos : -1;
+            lstream_move(s, p);
+            return x;
+        }
+
+        if (x == NULL) {
+            //The atom before this form ran up to it, its tail is expected too
+            r.track = 1;
+            if (s->tail >= 0) {
+                const char* q = s->buf + s->tail;
+                lval_del(lread_expr(&r, &q));
+            }
+            p = start;
+            lread_expr(&r, &p);
+            lread_expect(&r, start, expect_end);
+
+            if (r.s + r.err < end || s->eof) {
+                *err = lread_error(&r, s->filename, s->pos, s->pos_row, s->pos_col);
+                return NULL;
+            }
+        }
+
+        if (x) {lval_del(x);}
+        lstream_fill(s);
+    }
+}
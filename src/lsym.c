@@ -0,0 +1,78 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/lsym.h"
+#include "../include/lmem.h"
+
+static lsym** buckets = NULL;
+static uint32_t bucket_count = 0;
+static uint32_t sym_count = 0;
+
+//FNV-1a
+static uint32_t lsym_hash(char* s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void lsym_grow(void) {
+    uint32_t count = bucket_count ? bucket_count * 2 : 256;
+    lsym** grown = calloc(count, sizeof(lsym*));
+
+    for (uint32_t i = 0; i < bucket_count; i++) {
+        lsym* s = buckets[i];
+        while (s) {
+            lsym* next = s->next;
+            s->next = grown[s->hash & (count - 1)];
+            grown[s->hash & (count - 1)] = s;
+            s = next;
+        }
+    }
+
+    free(buckets);
+    buckets = grown;
+    bucket_count = count;
+}
+
+lsym* lsym_intern(char* name) {
+    uint32_t h = lsym_hash(name);
+
+    if (bucket_count) {
+        for (lsym* s = buckets[h & (bucket_count - 1)]; s; s = s->next) {
+            if (s->hash == h && strcmp(s->name, name) == 0) {return s;}
+        }
+    }
+
+    if (sym_count >= bucket_count / 2) {lsym_grow();}
+
+    //Symbols are never freed, keep them out of the arena
+    int active = lmem_arena_suspend();
+    lsym* s = lmem_alloc(sizeof(lsym));
+    s->name = lmem_alloc(strlen(name) + 1);
+    lmem_arena_resume(active);
+    strcpy(s->name, name);
+    s->hash = h;
+    sym_count++;
+    s->next = buckets[h & (bucket_count - 1)];
+    buckets[h & (bucket_count - 1)] = s;
+    return s;
+}
+
+void lsym_cleanup(void) {
+    for (uint32_t i = 0; i < bucket_count; i++) {
+        lsym* s = buckets[i];
+        while (s) {
+            lsym* next = s->next;
+            lmem_free(s->name, strlen(s->name) + 1);
+            lmem_free(s, sizeof(lsym));
+            s = next;
+        }
+    }
+
+    free(buckets);
+    buckets = NULL;
+    bucket_count = 0;
+    sym_count = 0;
+}
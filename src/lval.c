@@ -3,11 +3,18 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include "../include/lval.h"
+#include "../include/lmem.h"
+#include "../include/lsym.h"
+#include "../include/lgc.h"
+#include "../include/lvm.h"
+#include "../include/lenv.h"
 
 char* ltype_name(int t) {
     switch(t) {
-        case LVAL_FUN: return "Function";
+        case LVAL_FUN:
+        case LVAL_LAMBDA: return "Function";
         case LVAL_NUM: return "Number";
+        case LVAL_INT: return "Integer";
         case LVAL_ERR: return "Error";
         case LVAL_SYM: return "Symbol";
         case LVAL_SEXPR: return "S-Expression";
@@ -16,25 +23,38 @@ char* ltype_name(int t) {
     }
 }
 
-lval* lval_num(double x) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_NUM;
-    v->num = x;
+static lval* lval_new(int type) {
+    lval* v = lgc_alloc();
+    v->type = type;
+    v->refs = 1;
+    return v;
+}
+
+static char* lval_strdup(char* s) {
+    char* x = lmem_alloc(strlen(s) + 1);
+    strcpy(x, s);
+    return x;
+}
+
+static void lval_strfree(char* s) {
+    lmem_free(s, strlen(s) + 1);
+}
+
+lval* lval_int_box(int64_t x) {
+    lval* v = lval_new(LVAL_INT);
+    v->inum = x;
     return v;
 }
 
 lval* lval_err(char* fmt, ...) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_ERR;
+    lval* v = lval_new(LVAL_ERR);
 
     va_list va;
     va_start(va, fmt);
 
-    v->err = malloc(512);
-
-    vsnprintf(v->err, 511, fmt, va);
-
-    v->err= realloc(v->err, strlen(v->err) + 1);
+    char buffer[512];
+    vsnprintf(buffer, 511, fmt, va);
+    v->err = lval_strdup(buffer);
 
     va_end(va);
 
@@ -42,123 +62,554 @@ lval* lval_err(char* fmt, ...) {
 }
 
 lval* lval_sym(char* s) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_SYM;
-    v->sym = malloc(strlen(s) + 1);
-    strcpy(v->sym, s);
+    lval* v = lval_new(LVAL_SYM);
+    v->sym = lsym_intern(s);
     return v;
 }
 
 lval* lval_fun(lbuiltin func) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_FUN;
+    lval* v = lval_new(LVAL_FUN);
     v->fun = func;
     return v;
 }
 
+static size_t llambda_size(int count) {
+    return sizeof(llambda) + sizeof(lsym*) * count;
+}
+
+//Takes ownership of formals and body, a formal '&' marks the next as variadic
+lval* lval_lambda(lenv* env, lval* formals, lval* body) {
+    int count = 0;
+    int variadic = 0;
+    for (int i = 0; i < formals->count; i++) {
+        if (strcmp(formals->cell[i]->sym->name, "&") == 0) {
+            variadic = 1;
+        } else {
+            count++;
+        }
+    }
+
+    llambda* l = lmem_alloc(llambda_size(count));
+    l->count = 0;
+    l->variadic = variadic;
+    for (int i = 0; i < formals->count; i++) {
+        lsym* k = formals->cell[i]->sym;
+        if (strcmp(k->name, "&") != 0) {l->syms[l->count++] = k;}
+    }
+    l->formals = formals;
+    l->body = body;
+    //The global scope outlives every function, only frames are captured
+    l->env = env->par ? lenv_ref(env) : NULL;
+    l->code = NULL;
+
+    lval* v = lval_new(LVAL_LAMBDA);
+    v->lambda = l;
+    return v;
+}
+
 lval* lval_sexpr(void) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_SEXPR;
+    lval* v = lval_new(LVAL_SEXPR);
     v->count = 0;
+    v->off = 0;
     v->cell = NULL;
     return v;
 }
 
 lval* lval_qexpr(void) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_QEXPR;
+    lval* v = lval_new(LVAL_QEXPR);
     v->count = 0;
+    v->off = 0;
     v->cell = NULL;
     return v;
 }
 
+static size_t lvec_size(int capacity) {
+    return sizeof(lvec) + sizeof(lval*) * capacity;
+}
+
 void lval_del(lval* v) {
+    if (lval_is_imm(v)) {return;}
+    if (--v->refs > 0) {return;}
+
+    //If Qexpr or Sexpr is the last view of its items then delete them all
+    if (v->type == LVAL_QEXPR || v->type == LVAL_SEXPR) {
+        lvec* w = lval_vec(v);
+        if (w && w->refs == 1) {
+            for (int i = 0; i < w->len; i++) {
+                lval_del(w->items[i]);
+            }
+        }
+    }
+
+    lval_free(v);
+}
+
+//Releases the storage owned by v itself, its children are left alone
+void lval_free(lval* v) {
     switch (v->type) {
-        case LVAL_NUM:
-            break;
+        case LVAL_INT:
         case LVAL_FUN:
+        case LVAL_SYM:
             break;
         case LVAL_ERR:
-            free(v->err);
+            lval_strfree(v->err);
             break;
-        case LVAL_SYM:
-            free(v->sym);
+        case LVAL_LAMBDA: {
+            llambda* l = v->lambda;
+            lval_del(l->formals);
+            lval_del(l->body);
+            if (l->env) {lenv_del(l->env);}
+            if (l->code) {lcode_del(l->code);}
+            lmem_free(l, llambda_size(l->count));
             break;
-        //If Qexpr or Sexpr then delete all elements inside
+        }
         case LVAL_QEXPR:
-        case LVAL_SEXPR:
-            for (int i = 0; i < v->count; i++) {
-                lval_del(v->cell[i]);
+        case LVAL_SEXPR: {
+            lvec* w = lval_vec(v);
+            if (w && --w->refs == 0) {
+                if (w->code) {lcode_del(w->code);}
+                lmem_free(w, lvec_size(w->capacity));
             }
-            free(v->cell);
             break;
+        }
     }
 
-    free(v);
+    lgc_free(v);
 }
 
-lval* lval_add(lval* v, lval* x) {
-    v->count++;
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-    v->cell[v->count - 1] = x;
+lval* lval_ref(lval* v) {
+    if (!lval_is_imm(v)) {v->refs++;}
     return v;
 }
 
+//Shallow copy, the children are shared with v
 lval* lval_copy(lval* v) {
-    lval* x = malloc(sizeof(lval));
-    x->type = v->type;
+    if (lval_is_imm(v)) {return v;}
+
+    lval* x = lval_new(v->type);
 
     switch (v->type) {
+        case LVAL_INT:
+            x->inum = v->inum;
+            break;
         case LVAL_FUN:
             x->fun = v->fun;
             break;
-        case LVAL_NUM:
-            x->num = v->num;
+        case LVAL_LAMBDA: {
+            llambda* l = v->lambda;
+            x->lambda = lmem_alloc(llambda_size(l->count));
+            memcpy(x->lambda, l, llambda_size(l->count));
+            lval_ref(l->formals);
+            lval_ref(l->body);
+            if (l->env) {lenv_ref(l->env);}
+            x->lambda->code = NULL;
             break;
+        }
         case LVAL_ERR:
-            x->err = malloc(strlen(v->err) + 1);
-            strcpy(x->err, v->err);
+            x->err = lval_strdup(v->err);
             break;
         case LVAL_SYM:
-            x->sym = malloc(strlen(v->sym) + 1);
-            strcpy(x->sym, v->sym);
+            x->sym = v->sym;
             break;
         case LVAL_SEXPR:
         case LVAL_QEXPR:
             x->count = v->count;
-            x->cell = malloc(sizeof(lval*) * x->count);
-            for (int i=0; i < x->count; i++) {
-                x->cell[i] = lval_copy(v->cell[i]);
-            }
+            x->off = v->off;
+            x->cell = v->cell;
+            if (x->cell) {lval_vec(x)->refs++;}
             break;
     }
     return x;
 }
 
+//Gives v an lvec of its own that holds exactly its items
+static void lval_own_cells(lval* v) {
+    //A heap node whose items change may point into the arena from now on
+    if (lmem_arena_active() && !lmem_in_arena(v)) {v->mark |= LGC_YOUNG;}
+
+    lvec* w = lval_vec(v);
+    if (w == NULL) {return;}
+    if (w->refs == 1 && v->off == 0 && w->len == v->count) {return;}
+
+    if (w->refs == 1) {
+        for (int i = 0; i < v->off; i++) {
+            lval_del(w->items[i]);
+        }
+        for (int i = v->off + v->count; i < w->len; i++) {
+            lval_del(w->items[i]);
+        }
+        memmove(w->items, v->cell, sizeof(lval*) * v->count);
+        w->len = v->count;
+        if (w->code) {
+            lcode_del(w->code);
+            w->code = NULL;
+        }
+    } else {
+        lvec* x = lmem_alloc(lvec_size(v->count));
+        x->refs = 1;
+        x->mark = 0;
+        x->len = v->count;
+        x->capacity = v->count;
+        x->code = NULL;
+        for (int i = 0; i < v->count; i++) {
+            x->items[i] = lval_ref(v->cell[i]);
+        }
+        w->refs--;
+        w = x;
+    }
+
+    v->off = 0;
+    v->cell = w->items;
+}
+
+lval* lval_unshare(lval* v) {
+    if (lval_is_imm(v)) {return v;}
+
+    if (v->refs > 1) {
+        lval* x = lval_copy(v);
+        lval_del(v);
+        v = x;
+    }
+
+    if (v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) {lval_own_cells(v);}
+    return v;
+}
+
+//The n items of v from start on, sharing the items with v
+lval* lval_slice(lval* v, int start, int n) {
+    if (v->refs > 1) {
+        lval* x = lval_copy(v);
+        lval_del(v);
+        v = x;
+    }
+
+    if (v->cell) {
+        v->cell += start;
+        v->off += start;
+    }
+    v->count = n;
+    return v;
+}
+
+#define LVAL_MIN_CAPACITY 4
+
+static void lval_resize(lval* v, int capacity) {
+    lvec* w = lval_vec(v);
+    size_t old_size = w ? lvec_size(w->capacity) : 0;
+
+    w = lmem_realloc(w, old_size, lvec_size(capacity));
+    if (old_size == 0) {
+        w->refs = 1;
+        w->mark = 0;
+        w->len = 0;
+        w->code = NULL;
+    }
+    w->capacity = capacity;
+    v->cell = w->items;
+}
+
+lval* lval_reserve(lval* v, int capacity) {
+    v = lval_unshare(v);
+    lvec* w = lval_vec(v);
+
+    //Every in-place change goes through here, the cached code goes stale
+    if (w && w->code) {
+        lcode_del(w->code);
+        w->code = NULL;
+    }
+
+    int current = w ? w->capacity : 0;
+    if (capacity > current) {
+        int grown = current ? current * 2 : LVAL_MIN_CAPACITY;
+        lval_resize(v, grown > capacity ? grown : capacity);
+    }
+    return v;
+}
+
+lval* lval_add(lval* v, lval* x) {
+    v = lval_reserve(v, v->count + 1);
+    v->cell[v->count++] = x;
+    lval_vec(v)->len = v->count;
+    return v;
+}
+
+//Appends n values, taking over the references in xs
+lval* lval_append(lval* v, lval** xs, int n) {
+    if (n == 0) {return v;}
+
+    v = lval_reserve(v, v->count + n);
+    memcpy(&v->cell[v->count], xs, sizeof(lval*) * n);
+    v->count += n;
+    lval_vec(v)->len = v->count;
+    return v;
+}
+
+//Replaces the n values at i by the m values in xs, taking over their references
+lval* lval_splice(lval* v, int i, int n, lval** xs, int m) {
+    v = lval_reserve(v, v->count - n + m);
+    if (v->cell == NULL) {return v;}
+
+    for (int j = i; j < i + n; j++) {
+        lval_del(v->cell[j]);
+    }
+    if (v->count - i - n > 0) {
+        memmove(&v->cell[i + m], &v->cell[i + n],
+                sizeof(lval*) * (v->count - i - n));
+    }
+    if (m > 0) {memcpy(&v->cell[i], xs, sizeof(lval*) * m);}
+    v->count += m - n;
+
+    lvec* w = lval_vec(v);
+    w->len = v->count;
+
+    //Halve only once the array is less than a quarter full, so it is still
+    //at most half full afterwards and does not grow again on the next add
+    int capacity = w->capacity;
+    while (capacity / 2 >= LVAL_MIN_CAPACITY && v->count < capacity / 4) {
+        capacity /= 2;
+    }
+    if (capacity != w->capacity) {lval_resize(v, capacity);}
+    return v;
+}
+
 lval* lval_join(lval* x, lval* y) {
-    while (y->count > 0) {
-        x = lval_add(x, lval_pop(y, 0));
+    x = lval_reserve(x, x->count + y->count);
+
+    if (y->refs == 1) {
+        //Sole owner, move the children over instead of referencing them
+        lval_own_cells(y);
+        if (y->count) {memcpy(&x->cell[x->count], y->cell, sizeof(lval*) * y->count);}
+        x->count += y->count;
+        if (y->cell) {lval_vec(y)->len = 0;}
+        y->count = 0;
+    } else {
+        for (int i = 0; i < y->count; i++) {
+            x->cell[x->count++] = lval_ref(y->cell[i]);
+        }
     }
+    if (x->cell) {lval_vec(x)->len = x->count;}
 
     lval_del(y);
     return x;
 }
 
+//v must not be shared
 lval* lval_pop(lval* v, int i) {
-    lval* x = v->cell[i];
+    lval* x = lval_ref(v->cell[i]);
+    if (i == 0) {
+        lval_slice(v, 1, v->count - 1);
+    } else {
+        lval_splice(v, i, 1, NULL, 0);
+    }
+    return x;
+}
+
+lval* lval_take(lval* v, int i) {
+    lval* x = lval_ref(v->cell[i]);
+    lval_del(v);
+    return x;
+}
+
+/*
+ * Promotion maps every arena node and frame it reaches to its heap copy,
+ * which keeps shared values shared and stops at cycles through frames.
+ */
+static void** promoted_keys = NULL;
+static void** promoted_vals = NULL;
+static size_t promoted_count = 0;
+static size_t promoted_capacity = 0;
+
+static size_t lval_promoted_slot(void* k) {
+    size_t mask = promoted_capacity - 1;
+    size_t i = ((uintptr_t)k >> 3) * 0x9e3779b97f4a7c15u & mask;
+    while (promoted_keys[i] && promoted_keys[i] != k) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static void* lval_promoted(void* k) {
+    if (promoted_count == 0) {return NULL;}
+    size_t i = lval_promoted_slot(k);
+    return promoted_keys[i] ? promoted_vals[i] : NULL;
+}
+
+static void lval_promoted_put(void* k, void* x) {
+    if ((promoted_count + 1) * 2 > promoted_capacity) {
+        size_t old_capacity = promoted_capacity;
+        void** old_keys = promoted_keys;
+        void** old_vals = promoted_vals;
+
+        promoted_capacity = old_capacity ? old_capacity * 2 : 64;
+        promoted_keys = calloc(promoted_capacity, sizeof(void*));
+        promoted_vals = calloc(promoted_capacity, sizeof(void*));
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old_keys[i]) {
+                size_t j = lval_promoted_slot(old_keys[i]);
+                promoted_keys[j] = old_keys[i];
+                promoted_vals[j] = old_vals[i];
+            }
+        }
+        free(old_keys);
+        free(old_vals);
+    }
+
+    size_t i = lval_promoted_slot(k);
+    promoted_keys[i] = k;
+    promoted_vals[i] = x;
+    promoted_count++;
+}
+
+static lval* lval_promote_node(lval* v);
+
+static lenv* lval_promote_env(lenv* e) {
+    if (e == NULL || e->par == NULL) {return e;}
+
+    lenv* x = lval_promoted(e);
+    if (x) {return lenv_ref(x);}
+
+    lenv* par = lval_promote_env(e->par);
+    if (lmem_in_arena(e)) {
+        x = lenv_new_frame(par, e->count);
+        if (par->par) {lenv_del(par);}
+        memcpy(x->syms, e->syms, sizeof(lsym*) * e->count);
+    } else {
+        //Frames on the heap already are fixed up where they are
+        x = lenv_ref(e);
+        if (par != e->par) {
+            lenv_del(e->par);
+            e->par = par;
+        } else if (par->par) {
+            lenv_del(par);
+        }
+    }
+    lval_promoted_put(e, x);
+
+    for (int i = 0; i < e->count; i++) {
+        lval* val = e->vals[i];
+        x->vals[i] = val ? lval_promote_node(val) : NULL;
+        if (x == e && val) {lval_del(val);}
+    }
+    return x;
+}
+
+static void lval_promote_lambda(lval* x, llambda* l) {
+    llambda* p = lmem_alloc(llambda_size(l->count));
+    memcpy(p, l, llambda_size(l->count));
+    p->formals = lval_promote_node(l->formals);
+    p->body = lval_promote_node(l->body);
+    p->env = lval_promote_env(l->env);
+    //Compiled again on the next call, its constants are the old body
+    p->code = NULL;
+    x->lambda = p;
+}
+
+static void lval_promote_cells(lval* x, lval* v) {
+    int n = v->count;
+    lval** cell = NULL;
+    if (n > 0) {
+        lvec* w = lmem_alloc(lvec_size(n));
+        w->refs = 1;
+        w->mark = 0;
+        w->len = n;
+        w->capacity = n;
+        w->code = NULL;
+        for (int i = 0; i < n; i++) {
+            w->items[i] = lval_promote_node(v->cell[i]);
+        }
+        cell = w->items;
+    }
+    x->count = n;
+    x->off = 0;
+    x->cell = cell;
+}
+
+static lval* lval_promote_node(lval* v) {
+    if (lval_is_imm(v)) {return v;}
+
+    int arena = lmem_in_arena(v);
+    if (!arena && !(v->mark & LGC_YOUNG)) {return lval_ref(v);}
 
-    //Shift memory after the item at "i" over the top
-    memmove(&v->cell[i], &v->cell[i+1],
-            sizeof(lval*) * (v->count-i-1));
+    lval* x = lval_promoted(v);
+    if (x) {return lval_ref(x);}
 
-    v->count--;
+    if (!arena) {
+        //A young node is fixed up in place, holders of it see the change
+        v->mark &= ~LGC_YOUNG;
+        lval_promoted_put(v, v);
 
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
+        switch (v->type) {
+            case LVAL_ERR:
+                if (lmem_in_arena(v->err)) {v->err = lval_strdup(v->err);}
+                break;
+            case LVAL_LAMBDA: {
+                llambda* l = v->lambda;
+                lval_promote_lambda(v, l);
+                lval_del(l->formals);
+                lval_del(l->body);
+                if (l->env) {lenv_del(l->env);}
+                if (l->code) {lcode_del(l->code);}
+                lmem_free(l, llambda_size(l->count));
+                break;
+            }
+            case LVAL_SEXPR:
+            case LVAL_QEXPR: {
+                lval old = *v;
+                lval_promote_cells(v, &old);
+                lvec* w = lval_vec(&old);
+                if (w && w->refs == 1) {
+                    for (int i = 0; i < w->len; i++) {
+                        lval_del(w->items[i]);
+                    }
+                }
+                if (w && --w->refs == 0) {
+                    if (w->code) {lcode_del(w->code);}
+                    lmem_free(w, lvec_size(w->capacity));
+                }
+                break;
+            }
+        }
+        return lval_ref(v);
+    }
+
+    x = lval_new(v->type);
+    lval_promoted_put(v, x);
+
+    switch (v->type) {
+        case LVAL_INT:
+            x->inum = v->inum;
+            break;
+        case LVAL_FUN:
+            x->fun = v->fun;
+            break;
+        case LVAL_SYM:
+            x->sym = v->sym;
+            break;
+        case LVAL_ERR:
+            x->err = lval_strdup(v->err);
+            break;
+        case LVAL_LAMBDA:
+            lval_promote_lambda(x, v->lambda);
+            break;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            lval_promote_cells(x, v);
+            break;
+    }
     return x;
 }
 
-lval* lval_take(lval* v, int i) {
-    lval* x = lval_pop(v, i);
-    lval_del(v);
+//A reference to v, or to a copy of it, that holds nothing in the arena
+lval* lval_promote(lval* v) {
+    if (!lmem_arena_active()) {return lval_ref(v);}
+
+    int active = lmem_arena_suspend();
+    lval* x = lval_promote_node(v);
+    lmem_arena_resume(active);
+
+    if (promoted_count > 0) {
+        memset(promoted_keys, 0, sizeof(void*) * promoted_capacity);
+        promoted_count = 0;
+    }
     return x;
 }
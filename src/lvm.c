@@ -0,0 +1,728 @@
+#include <stdlib.h>
+#include "../include/lvm.h"
+#include "../include/lenv.h"
+#include "../include/builtins.h"
+#include "../include/lgc.h"
+#include "../include/lopt.h"
+#include "../include/io.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LVM_COMPUTED_GOTO
+#endif
+
+static lcode* lcode_new(void) {
+    lcode* c = calloc(1, sizeof(lcode));
+    return c;
+}
+
+void lcode_del(lcode* c) {
+    for (int i = 0; i < c->const_count; i++) {
+        lval_del(c->consts[i]);
+    }
+    free(c->consts);
+    free(c->caches);
+    free(c->checks);
+    free(c->folds);
+    if (c->error) {lval_del(c->error);}
+    free(c->ops);
+    free(c);
+}
+
+static void lcode_emit(lcode* c, int op, int arg) {
+    if (c->count == c->capacity) {
+        c->capacity = c->capacity ? c->capacity * 2 : 16;
+        c->ops = realloc(c->ops, sizeof(uint32_t) * c->capacity);
+    }
+    c->ops[c->count++] = LOP(op, arg);
+}
+
+//Takes a new reference to v
+static int lcode_const(lcode* c, lval* v) {
+    if (c->const_count == c->const_capacity) {
+        c->const_capacity = c->const_capacity ? c->const_capacity * 2 : 8;
+        c->consts = realloc(c->consts, sizeof(lval*) * c->const_capacity);
+    }
+    c->consts[c->const_count] = lval_ref(v);
+    return c->const_count++;
+}
+
+//Cache entry for a lookup of the global v
+static int lcode_cache(lcode* c, lval* v) {
+    if (c->cache_count == c->cache_capacity) {
+        c->cache_capacity = c->cache_capacity ? c->cache_capacity * 2 : 8;
+        c->caches = realloc(c->caches, sizeof(lcache) * c->cache_capacity);
+    }
+    int i = lcode_const(c, v);
+    lcache* k = &c->caches[c->cache_count];
+    k->sym = c->consts[i];
+    k->version = 0;
+    k->value = NULL;
+    return c->cache_count++;
+}
+
+//Resolves a symbol against the frames of scope
+static void lcode_symbol(lcode* c, lval* v, lenv* scope) {
+    int depth = 0;
+    for (lenv* f = scope; f && f->par; f = f->par, depth++) {
+        int i = lenv_find(f, v->sym);
+        if (i < 0) {continue;}
+
+        if (depth <= LOP_MAX_DEPTH && i <= LOP_MAX_SLOT) {
+            lcode_emit(c, LOP_LOCAL, LOP_LOCAL_ARG(depth, i));
+        } else {
+            lcode_emit(c, LOP_LOOKUP, lcode_const(c, v));
+        }
+        return;
+    }
+
+    lcode_emit(c, LOP_GLOBAL, lcode_cache(c, v));
+}
+
+//Builtin the global v is bound to, if there is one
+static lbuiltin lcode_builtin(lval* v, lenv* scope) {
+    if (lval_type(v) != LVAL_SYM) {return NULL;}
+    for (lenv* f = scope; f->par; f = f->par) {
+        if (lenv_find(f, v->sym) >= 0) {return NULL;}
+    }
+
+    lval* x = lenv_get(lenv_root(scope), v);
+    lbuiltin fun = lval_type(x) == LVAL_FUN ? x->fun : NULL;
+    lval_del(x);
+    return fun;
+}
+
+//Signature of the builtin the global v is bound to, if there is one
+static const lsig* lcode_sig(lval* v, lenv* scope) {
+    lbuiltin fun = lcode_builtin(v, scope);
+    return fun ? builtin_sig(fun) : NULL;
+}
+
+//Builtins that bind globals or run code that may
+static lbuiltin binders[] = {builtin_def, builtin_let, builtin_eval};
+
+//1 if running the call v may rebind a builtin before all of its calls are
+//made. Functions other than builtins may do anything.
+static int lcode_rebinds(lval* v, lenv* scope) {
+    if (v->count > 1) {
+        lval* f = v->cell[0];
+        if (lval_type(f) == LVAL_SEXPR) {return 1;}
+        if (lval_type(f) == LVAL_SYM) {
+            lbuiltin fun = lcode_builtin(f, scope);
+            if (fun == NULL) {return 1;}
+            for (size_t i = 0; i < sizeof(binders) / sizeof(binders[0]); i++) {
+                if (binders[i] == fun) {return 1;}
+            }
+        }
+    }
+
+    for (int i = 0; i < v->count; i++) {
+        if (lval_type(v->cell[i]) == LVAL_SEXPR && lcode_rebinds(v->cell[i], scope)) {return 1;}
+    }
+    return 0;
+}
+
+//Type of the value of v unless its evaluation fails, -1 if it is not known
+static int lcode_type(lval* v, lenv* scope) {
+    switch (lval_type(v)) {
+        case LVAL_SYM:
+            return -1;
+        case LVAL_SEXPR: {
+            if (v->count == 0) {return LVAL_SEXPR;}
+            if (v->count == 1) {return lcode_type(v->cell[0], scope);}
+            const lsig* s = lcode_sig(v->cell[0], scope);
+            return s ? s->result : -1;
+        }
+        default:
+            return lval_type(v);
+    }
+}
+
+//Checks the arguments of the call v against s. Returns 1 if they are proven
+//to match, 0 if that is not known or they cannot match. The latter is an
+//error if the code is strict. The values of the first arguments may be
+//known, in args.
+static int lcode_check(lcode* c, lval* v, lval* args, const lsig* s, lenv* scope) {
+    int n = v->count - 1;
+    if (s->args >= 0 && n != s->args) {
+        if (!c->strict) {return 0;}
+        c->error = lval_err("Function '%s' passed too many arguments! Got %i, expected %i.",
+                            s->name, n, s->args);
+        return 0;
+    }
+    if (s->type < 0) {return 1;}
+
+    int proven = 1;
+    for (int i = 0; i < n; i++) {
+        int t = args && i < args->count ? lval_type(args->cell[i])
+                                        : lcode_type(v->cell[i+1], scope);
+        if (t < 0) {
+            proven = 0;
+            continue;
+        }
+
+        int match = s->type == LVAL_NUM ? (t == LVAL_NUM || t == LVAL_INT) : t == s->type;
+        if (!match) {
+            if (!c->strict) {return 0;}
+            c->error = lval_err("Function '%s' passed incorrect type at index %i! Got %s, expected %s.",
+                                s->name, i, ltype_name(t), ltype_name(s->type));
+            return 0;
+        }
+    }
+    return proven;
+}
+
+static int lcode_proven(lcode* c, int n, lbuiltin unchecked) {
+    if (c->check_count == c->check_capacity) {
+        c->check_capacity = c->check_capacity ? c->check_capacity * 2 : 8;
+        c->checks = realloc(c->checks, sizeof(lcheck) * c->check_capacity);
+    }
+    lcheck* k = &c->checks[c->check_count];
+    k->n = n;
+    k->unchecked = unchecked;
+    k->version = lenv_builtin_version;
+    return c->check_count++;
+}
+
+static int dump_folds = 0;
+
+void lvm_set_dump_folds(int dump) {
+    dump_folds = dump;
+}
+
+//Stands the constant v in for the instructions of the call from start on
+static void lcode_fold(lcode* c, int start, lval* call, lval* v) {
+    if (dump_folds) {
+        printf("; ");
+        lval_print(call);
+        printf(" => ");
+        lval_println(v);
+    }
+
+    if (c->fold_count == c->fold_capacity) {
+        c->fold_capacity = c->fold_capacity ? c->fold_capacity * 2 : 8;
+        c->folds = realloc(c->folds, sizeof(lfold) * c->fold_capacity);
+    }
+    lfold* k = &c->folds[c->fold_count];
+    k->value = lcode_const(c, v);
+    k->skip = c->count - start;
+    k->version = lenv_builtin_version;
+
+    //Emitted at the end to make room, then moved in front of the call
+    lcode_emit(c, LOP_FOLDED, c->fold_count);
+    memmove(c->ops + start + 1, c->ops + start, sizeof(uint32_t) * k->skip);
+    c->ops[start] = LOP(LOP_FOLDED, c->fold_count++);
+}
+
+static lval* lcode_expr(lcode* c, lval* v, lenv* scope, int depth);
+
+//Returns the value of the call if it is folded
+static lval* lcode_call(lcode* c, lval* v, lenv* scope, int depth) {
+    int start = c->count;
+    //Values of the arguments for as long as they are all known. Nothing is
+    //folded in code that may rebind a builtin before the call is made.
+    lval* args = NULL;
+    int known = c->strict;
+    for (int i = 0; i < v->count; i++) {
+        lval* x = lcode_expr(c, v->cell[i], scope, depth + i);
+        //The function is not one of the values, unless it is all there is
+        if (i == 0 && v->count > 1) {
+            if (x) {lval_del(x);}
+            continue;
+        }
+
+        if (x && known) {
+            args = lval_add(args ? args : lval_sexpr(), x);
+        } else {
+            if (x) {lval_del(x);}
+            known = 0;
+        }
+    }
+    if (c->error) {
+        if (args) {lval_del(args);}
+        return NULL;
+    }
+
+    const lsig* s = v->count > 1 ? lcode_sig(v->cell[0], scope) : NULL;
+    if (s && lcode_check(c, v, args, s, scope) && s->unchecked) {
+        lcode_emit(c, LOP_CALL_PROVEN, lcode_proven(c, v->count, s->unchecked));
+    } else {
+        lcode_emit(c, LOP_CALL, v->count);
+    }
+    if (c->error || !known || v->count == 0) {
+        if (args) {lval_del(args);}
+        return NULL;
+    }
+
+    //A call of a single constant is that constant, nothing needs folding
+    if (v->count == 1) {return lval_take(args, 0);}
+
+    lval* x = lopt_value(scope, v->cell[0], args);
+    if (x == NULL) {return NULL;}
+
+    //The code may outlive the arena the value was computed in
+    lval* y = lval_promote(x);
+    lval_del(x);
+    lcode_fold(c, start, v, y);
+    return y;
+}
+
+//Returns the value of v if it is a constant or a folded call
+static lval* lcode_expr(lcode* c, lval* v, lenv* scope, int depth) {
+    if (c->error) {return NULL;}
+    if (depth + 1 > c->max_stack) {c->max_stack = depth + 1;}
+
+    switch (lval_type(v)) {
+        case LVAL_SYM:
+            lcode_symbol(c, v, scope);
+            return NULL;
+        case LVAL_SEXPR:
+            return lcode_call(c, v, scope, depth);
+        case LVAL_ERR:
+            //Such as a number that failed to read
+            c->error = lval_ref(v);
+            return NULL;
+        default:
+            lcode_emit(c, LOP_CONST, lcode_const(c, v));
+            return lval_ref(v);
+    }
+}
+
+lcode* lcode_compile(lval* v, lenv* scope) {
+    lcode* c = lcode_new();
+    c->strict = lval_type(v) != LVAL_SEXPR || !lcode_rebinds(v, scope);
+    lval* x = lcode_expr(c, v, scope, 0);
+    if (x) {lval_del(x);}
+    lcode_emit(c, LOP_RETURN, 0);
+    return c;
+}
+
+//Compiles the items of the S- or Q-expression v as a call
+lcode* lcode_compile_sexpr(lval* v, lenv* scope) {
+    lcode* c = lcode_new();
+    if (c->max_stack < 1) {c->max_stack = 1;}
+    c->strict = !lcode_rebinds(v, scope);
+    lval* x = lcode_call(c, v, scope, 0);
+    if (x) {lval_del(x);}
+    lcode_emit(c, LOP_RETURN, 0);
+    c->off = v->off;
+    c->len = v->count;
+    return c;
+}
+
+//Compiles the body of the function f, created in e, against the layout of
+//its call frames. Returns the error if the body can never run.
+lval* lcode_compile_lambda(lval* f, lenv* e) {
+    llambda* l = f->lambda;
+    if (l->code == NULL) {
+        lenv* scope = lenv_new_frame(l->env ? l->env : lenv_root(e), l->count);
+        memcpy(scope->syms, l->syms, sizeof(lsym*) * l->count);
+        memset(scope->vals, 0, sizeof(lval*) * l->count);
+        l->code = lcode_compile_sexpr(l->body, scope);
+        lenv_del(scope);
+    }
+
+    //Code that cannot run is not kept, its error may live in the arena
+    if (l->code->error) {
+        lval* err = lval_ref(l->code->error);
+        lcode_del(l->code);
+        l->code = NULL;
+        return err;
+    }
+    return NULL;
+}
+
+//The value stack is shared by nested runs, each run works above the last
+static lval** stack = NULL;
+static int stack_size = 0;
+static int stack_top = 0;
+
+static void lvm_reserve(int n) {
+    if (stack_top + n <= stack_size) {return;}
+    while (stack_top + n > stack_size) {
+        stack_size = stack_size ? stack_size * 2 : 256;
+    }
+    stack = realloc(stack, sizeof(lval*) * stack_size);
+}
+
+/*
+ * Code being run. A frame keeps its environment, and whatever owns its code,
+ * alive until it returns. `base` is where its values start on the stack.
+ */
+typedef struct lframe {
+    lcode* code;
+    uint32_t* ip;
+    lenv* env;
+    lval* hold;
+    int owns_code;
+    int base;
+} lframe;
+
+static lframe* frames = NULL;
+static int frame_count = 0;
+static int frame_capacity = 0;
+static int max_depth = LVM_DEFAULT_MAX_DEPTH;
+
+//Frame a builtin asked to be entered through lvm_enter
+static lframe pending;
+
+void lvm_set_max_depth(int depth) {
+    max_depth = depth;
+}
+
+static void lvm_release(lframe* f) {
+    if (f->env->par) {lenv_del(f->env);}
+    if (f->hold) {lval_del(f->hold);}
+    if (f->owns_code) {lcode_del(f->code);}
+}
+
+//Fills in f to evaluate v as an S-expression in e, returns the result instead
+//if there is nothing to run
+static lval* lvm_prepare(lframe* f, lenv* e, lval* v) {
+    lvec* w = lval_vec(v);
+    if (w == NULL) {
+        lval_del(v);
+        return lval_sexpr();
+    }
+
+    //Code compiled against local frames is only valid for that scope
+    if (e->par) {
+        lcode* c = lcode_compile_sexpr(v, e);
+        if (c->error) {
+            lval* err = lval_ref(c->error);
+            lcode_del(c);
+            lval_del(v);
+            return err;
+        }
+        f->code = c;
+        f->owns_code = 1;
+    } else {
+        if (w->code == NULL || w->code->off != v->off || w->code->len != v->count) {
+            if (w->code) {lcode_del(w->code);}
+            w->code = lcode_compile_sexpr(v, e);
+        }
+        if (w->code->error) {
+            lval* err = lval_ref(w->code->error);
+            lcode_del(w->code);
+            w->code = NULL;
+            lval_del(v);
+            return err;
+        }
+        f->code = w->code;
+        f->owns_code = 0;
+    }
+
+    f->env = e->par ? lenv_ref(e) : e;
+    f->hold = v;
+    return NULL;
+}
+
+lval* lvm_enter(lenv* e, lval* v) {
+    return lvm_prepare(&pending, e, v);
+}
+
+//Binds the n arguments straight into the slots of a new frame, there is no
+//argument list. Consumes f and the arguments.
+static lval* lvm_call_lambda(lenv* e, lval* f, lval** args, int n) {
+    llambda* l = f->lambda;
+    int fixed = l->count - l->variadic;
+
+    if (n < fixed || (n > fixed && !l->variadic)) {
+        lval* err = lval_err("Function passed incorrect number of arguments! Got %i, expected %s%i.",
+                             n, l->variadic ? "at least " : "", fixed);
+        for (int i = 0; i < n; i++) {
+            lval_del(args[i]);
+        }
+        lval_del(f);
+        return err;
+    }
+
+    //Every call frame has the same layout, so the code is compiled only once
+    lval* err = lcode_compile_lambda(f, e);
+    if (err) {
+        for (int i = 0; i < n; i++) {
+            lval_del(args[i]);
+        }
+        lval_del(f);
+        return err;
+    }
+
+    lenv* frame = lenv_new_frame(l->env ? l->env : lenv_root(e), l->count);
+    memcpy(frame->syms, l->syms, sizeof(lsym*) * l->count);
+    if (fixed > 0) {memcpy(frame->vals, args, sizeof(lval*) * fixed);}
+    if (l->variadic) {
+        frame->vals[fixed] = lval_append(lval_qexpr(), args + fixed, n - fixed);
+    }
+
+    pending.code = l->code;
+    pending.env = frame;
+    pending.hold = f;
+    pending.owns_code = 0;
+    return NULL;
+}
+
+//Evaluates the n values in vals as an S-expression, consuming them. None of
+//them is an error, evaluation stops at the first error instead. Returns
+//NULL if the evaluation continues in the pending frame. A builtin is called
+//through unchecked instead if that is given.
+static lval* lvm_apply(lenv* e, lval** vals, int n, lbuiltin unchecked) {
+    if (n == 0) {return lval_sexpr();}
+    if (n == 1) {return vals[0];}
+
+    lval* f = vals[0];
+    if (lval_type(f) == LVAL_LAMBDA) {
+        return lvm_call_lambda(e, f, vals + 1, n - 1);
+    }
+
+    if (lval_type(f) != LVAL_FUN) {
+        lval* err = lval_err("first element is not a function, got '%s'",
+                             ltype_name(lval_type(f)));
+        for (int i = 0; i < n; i++) {
+            lval_del(vals[i]);
+        }
+        return err;
+    }
+
+    //f stays on the stack while it runs, so the collector sees it
+    stack_top = (int)(vals - stack) + 1;
+    lval* args = lval_append(lval_sexpr(), vals + 1, n - 1);
+    lval* result = unchecked ? unchecked(e, args) : f->fun(e, args);
+    lval_del(f);
+    return result;
+}
+
+//Pushes f with its values starting at base, 0 if that is too deep
+static int lvm_push(lframe* f, int base) {
+    if (frame_count >= max_depth) {
+        lvm_release(f);
+        return 0;
+    }
+
+    if (frame_count == frame_capacity) {
+        frame_capacity = frame_capacity ? frame_capacity * 2 : 64;
+        frames = realloc(frames, sizeof(lframe) * frame_capacity);
+    }
+
+    f->ip = f->code->ops;
+    f->base = base;
+    frames[frame_count++] = *f;
+
+    stack_top = base;
+    lvm_reserve(f->code->max_stack);
+    return 1;
+}
+
+static lval* lvm_depth_error(void) {
+    return lval_err("Maximum evaluation depth of %i exceeded!", max_depth);
+}
+
+/*
+ * Runs frame f to completion. Calls to functions and to eval push a frame
+ * instead of recursing, and a call in tail position replaces the frame
+ * making it, so the C stack does not grow with the depth of the evaluation.
+ */
+static lval* lvm_run(lframe* f) {
+    int entry = frame_count;
+    int entry_base = stack_top;
+    if (!lvm_push(f, entry_base)) {return lvm_depth_error();}
+
+    lenv* globals = lenv_root(f->env);
+    lframe* cur = &frames[frame_count - 1];
+    lcode* c = cur->code;
+    lenv* e = cur->env;
+    uint32_t* ip = cur->ip;
+    lval** sp = stack + cur->base;
+    uint32_t ins;
+    int n;
+    lbuiltin unchecked;
+    lval* result;
+
+#ifdef LVM_COMPUTED_GOTO
+    static void* labels[] = {&&op_LOP_CONST, &&op_LOP_GLOBAL, &&op_LOP_LOCAL,
+                             &&op_LOP_LOOKUP, &&op_LOP_CALL, &&op_LOP_CALL_PROVEN,
+                             &&op_LOP_FOLDED, &&op_LOP_RETURN};
+    #define NEXT() ins = *ip++; goto *labels[LOP_CODE(ins)]
+    #define OP(name) op_##name
+    NEXT();
+#else
+    #define NEXT() continue
+    #define OP(name) case name
+    for (;;) {
+    ins = *ip++;
+    switch (LOP_CODE(ins)) {
+#endif
+
+    OP(LOP_CONST):
+        *sp++ = lval_ref(c->consts[LOP_ARG(ins)]);
+        NEXT();
+
+    OP(LOP_GLOBAL): {
+        lcache* k = &c->caches[LOP_ARG(ins)];
+        if (k->version != lenv_version) {
+            lval* v = lenv_get(globals, k->sym);
+            if (lval_type(v) == LVAL_ERR) {
+                result = v;
+                goto unwind;
+            }
+            k->value = v;
+            k->version = lenv_version;
+            *sp++ = v;
+            NEXT();
+        }
+        *sp++ = lval_ref(k->value);
+        NEXT();
+    }
+
+    OP(LOP_LOCAL): {
+        lenv* f = e;
+        for (uint32_t d = LOP_ARG(ins) >> 16; d > 0; d--) {f = f->par;}
+        *sp++ = lval_ref(f->vals[LOP_ARG(ins) & LOP_MAX_SLOT]);
+        NEXT();
+    }
+
+    OP(LOP_LOOKUP):
+        result = lenv_get(e, c->consts[LOP_ARG(ins)]);
+        if (lval_type(result) == LVAL_ERR) {goto unwind;}
+        *sp++ = result;
+        NEXT();
+
+    OP(LOP_CALL_PROVEN): {
+        //The proof holds while the builtins are bound as they were
+        lcheck* k = &c->checks[LOP_ARG(ins)];
+        n = k->n;
+        unchecked = k->version == lenv_builtin_version ? k->unchecked : NULL;
+        goto call;
+    }
+
+    OP(LOP_FOLDED): {
+        //The result holds while the builtins are bound as they were
+        lfold* k = &c->folds[LOP_ARG(ins)];
+        if (k->version == lenv_builtin_version) {
+            *sp++ = lval_ref(c->consts[k->value]);
+            ip += k->skip;
+        }
+        NEXT();
+    }
+
+    OP(LOP_CALL):
+        n = LOP_ARG(ins);
+        unchecked = NULL;
+    call: {
+        sp -= n;
+        //Nested runs start above the values still on this run's stack
+        int top = (int)(sp - stack);
+        stack_top = top;
+        result = lvm_apply(e, sp, n, unchecked);
+
+        if (result == NULL) {
+            //Nothing is left of a frame whose last act is the call
+            if (LOP_CODE(*ip) == LOP_RETURN) {
+                top = cur->base;
+                lvm_release(cur);
+                frame_count--;
+            } else {
+                cur->ip = ip;
+            }
+
+            if (lvm_push(&pending, top)) {
+                cur = &frames[frame_count - 1];
+                c = cur->code;
+                e = cur->env;
+                ip = cur->ip;
+                sp = stack + cur->base;
+                NEXT();
+            }
+
+            sp = stack + top;
+            result = lvm_depth_error();
+            goto unwind;
+        }
+
+        sp = stack + top;
+        if (lval_type(result) == LVAL_ERR) {goto unwind;}
+        *sp++ = result;
+        NEXT();
+    }
+
+    OP(LOP_RETURN): {
+        result = *--sp;
+        int base = cur->base;
+        lvm_release(cur);
+        frame_count--;
+
+        if (frame_count == entry) {
+            stack_top = base;
+            return result;
+        }
+
+        cur = &frames[frame_count - 1];
+        c = cur->code;
+        e = cur->env;
+        ip = cur->ip;
+        sp = stack + base;
+        *sp++ = result;
+        stack_top = base + 1;
+        NEXT();
+    }
+
+#ifndef LVM_COMPUTED_GOTO
+    }
+    }
+#endif
+#undef NEXT
+#undef OP
+
+    //An error ends the whole run, whatever is left to evaluate would only
+    //be thrown away. Release everything the run still holds in one go.
+unwind:
+    for (lval** p = stack + entry_base; p < sp; p++) {
+        lval_del(*p);
+    }
+    while (frame_count > entry) {
+        lvm_release(&frames[--frame_count]);
+    }
+    stack_top = entry_base;
+    return result;
+}
+
+//Below stack_top are the values of the calls in progress, a builtin only
+//holds its arguments
+void lvm_mark_roots(void) {
+    for (int i = 0; i < stack_top; i++) {
+        lgc_root(stack[i]);
+    }
+    for (int i = 0; i < frame_count; i++) {
+        lgc_root_env(frames[i].env);
+        if (frames[i].hold) {lgc_root(frames[i].hold);}
+        lgc_root_code(frames[i].code);
+    }
+}
+
+void lvm_cleanup(void) {
+    free(stack);
+    stack = NULL;
+    stack_size = stack_top = 0;
+    free(frames);
+    frames = NULL;
+    frame_count = frame_capacity = 0;
+}
+
+lval* lval_eval(lenv* e, lval* v) {
+    if (lval_type(v) == LVAL_SYM) {
+        lval* x = lenv_get(e, v);
+        lval_del(v);
+        return x;
+    }
+
+    if (lval_type(v) == LVAL_SEXPR) {
+        return lval_eval_sexpr(e, v);
+    }
+
+    return v;
+}
+
+lval* lval_eval_sexpr(lenv* e, lval* v) {
+    lframe f;
+    lval* result = lvm_prepare(&f, e, v);
+    if (result) {return result;}
+    return lvm_run(&f);
+}
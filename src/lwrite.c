@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#include <math.h>
+#include "../include/lwrite.h"
+
+static const uint64_t lwrite_pow10[] = {1, 10, 100, 1000};
+
+static lwriter* lwriter_new(FILE* file, int fd) {
+    lwriter* w = malloc(sizeof(lwriter));
+    w->file = file;
+    w->fd = fd;
+    w->capacity = LWRITE_CHUNK;
+    w->buf = malloc(w->capacity);
+    w->len = 0;
+    w->error = 0;
+    return w;
+}
+
+lwriter* lwriter_file(FILE* file) {
+    return lwriter_new(file, -1);
+}
+
+#ifndef _WIN32
+lwriter* lwriter_fd(int fd) {
+    return lwriter_new(NULL, fd);
+}
+#endif
+
+lwriter* lwriter_string(void) {
+    return lwriter_new(NULL, -1);
+}
+
+void lwriter_del(lwriter* w) {
+    lwriter_flush(w);
+    free(w->buf);
+    free(w);
+}
+
+//Hands n bytes at s on to the stream or descriptor
+static void lwriter_out(lwriter* w, const char* s, size_t n) {
+    if (w->error) {return;}
+    if (w->file) {
+        if (fwrite(s, 1, n, w->file) != n) {w->error = 1;}
+        return;
+    }
+#ifndef _WIN32
+    while (n > 0) {
+        ssize_t written = write(w->fd, s, n);
+        if (written < 0) {
+            w->error = 1;
+            return;
+        }
+        s += written;
+        n -= (size_t)written;
+    }
+#endif
+}
+
+int lwriter_flush(lwriter* w) {
+    if (w->file == NULL && w->fd < 0) {return 0;}
+    lwriter_out(w, w->buf, w->len);
+    w->len = 0;
+    if (w->file && fflush(w->file) != 0) {w->error = 1;}
+    return w->error ? -1 : 0;
+}
+
+char* lwriter_take(lwriter* w) {
+    char* s = realloc(w->buf, w->len + 1);
+    s[w->len] = '\0';
+    w->capacity = LWRITE_CHUNK;
+    w->buf = malloc(w->capacity);
+    w->len = 0;
+    return s;
+}
+
+void lwriter_put(lwriter* w, const char* s, size_t n) {
+    if (w->capacity - w->len >= n) {
+        memcpy(w->buf + w->len, s, n);
+        w->len += n;
+        return;
+    }
+
+    //A string writer keeps everything
+    if (w->file == NULL && w->fd < 0) {
+        while (w->capacity - w->len < n) {w->capacity *= 2;}
+        w->buf = realloc(w->buf, w->capacity);
+        memcpy(w->buf + w->len, s, n);
+        w->len += n;
+        return;
+    }
+
+    lwriter_out(w, w->buf, w->len);
+    w->len = 0;
+    if (n >= w->capacity) {
+        lwriter_out(w, s, n);
+        return;
+    }
+    memcpy(w->buf, s, n);
+    w->len = n;
+}
+
+void lwriter_puts(lwriter* w, const char* s) {
+    lwriter_put(w, s, strlen(s));
+}
+
+//Writes the digits of x, padded with zeros to at least width digits
+static void lwriter_digits(lwriter* w, uint64_t x, int width) {
+    char buffer[24];
+    char* p = buffer + sizeof(buffer);
+    do {
+        *--p = (char)('0' + x % 10);
+        x /= 10;
+        width--;
+    } while (x != 0);
+    while (width-- > 0) {*--p = '0';}
+    lwriter_put(w, p, (size_t)(buffer + sizeof(buffer) - p));
+}
+
+void lwriter_int(lwriter* w, int64_t x) {
+    if (x < 0) {
+        lwriter_putc(w, '-');
+        lwriter_digits(w, (uint64_t)0 - (uint64_t)x, 1);
+        return;
+    }
+    lwriter_digits(w, (uint64_t)x, 1);
+}
+
+void lwriter_fixed(lwriter* w, double x, int prec) {
+    double a = fabs(x);
+    //Out of the range of the exact path, printf knows best
+    if (!(a < 9223372036854775808.0) || prec < 0 || prec > 3) {
+        char buffer[512];
+        int n = snprintf(buffer, sizeof(buffer), "%.*f", prec, x);
+        lwriter_put(w, buffer, (size_t)n);
+        return;
+    }
+
+    //a = ip + frac, both parts are exact. frac is m / 2^shift, so the first
+    //prec decimals are m * 10^prec / 2^shift, which is rounded to nearest
+    //with ties to even on the exact value, as printf does
+    uint64_t ip = (uint64_t)a;
+    double frac = a - (double)ip;
+    uint64_t q = 0;
+    if (frac != 0) {
+        int ex;
+        double f = frexp(frac, &ex);
+        uint64_t m = (uint64_t)ldexp(f, 53);
+        int shift = 53 - ex;
+        uint64_t scaled = m * lwrite_pow10[prec];
+        //Below 2^63, so less than half of the last digit once shift is 64
+        if (shift < 64) {
+            q = scaled >> shift;
+            uint64_t rem = scaled & (((uint64_t)1 << shift) - 1);
+            uint64_t half = (uint64_t)1 << (shift - 1);
+            uint64_t last = prec > 0 ? q : ip;
+            if (rem > half || (rem == half && (last & 1))) {q++;}
+        }
+        if (q == lwrite_pow10[prec]) {
+            q = 0;
+            ip++;
+        }
+    }
+
+    if (signbit(x)) {lwriter_putc(w, '-');}
+    lwriter_digits(w, ip, 1);
+    if (prec == 0) {return;}
+    lwriter_putc(w, '.');
+    lwriter_digits(w, q, prec);
+}
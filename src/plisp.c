@@ -1,8 +1,15 @@
+#include <errno.h>
+#include <limits.h>
 #include "../lib/mpc.h"
 #include "../include/lval.h"
 #include "../include/lenv.h"
 #include "../include/io.h"
 #include "../include/builtins.h"
+#include "../include/lmem.h"
+#include "../include/lsym.h"
+#include "../include/lgc.h"
+#include "../include/lvm.h"
+#include "../include/lread.h"
 
 #ifdef _WIN32
 #include <string.h>
@@ -27,7 +34,102 @@ void add_history(char* unused) {}
 static char* lisp_name = "plisp";
 static char* prompt_prefix = "> ";
 
+//Reads a line with the mpc grammar, or with the direct reader if parser is
+//NULL. Prints why the line cannot be read if it cannot.
+static lval* read_line(mpc_parser_t* parser, char* input) {
+    if (parser == NULL) {
+        char* err;
+        lval* x = lread_string("<stdin>", input, &err);
+        if (x == NULL) {
+            fputs(err, stdout);
+            free(err);
+        }
+        return x;
+    }
+
+    mpc_result_t r;
+    if (!mpc_parse("<stdin>", input, parser, &r)) {
+        mpc_err_print(r.error);
+        mpc_err_delete(r.error);
+        return NULL;
+    }
+    lval* x = lval_read(r.output);
+    mpc_ast_delete(r.output);
+    return x;
+}
+
+//Evaluates and prints a form. Errors in a script say where the form starts.
+static void eval_print(lenv* e, lval* x, lstream* s) {
+    lval* y = lval_eval(e, x);
+    if (s && lval_type(y) == LVAL_ERR) {printf("%s:%i:%li: ", s->filename, s->row, s->col);}
+    lval_println(y);
+    lval_del(y);
+}
+
+//Runs the forms in the file at path, or in stdin for "-", one at a time.
+//Stops at the first form that cannot be read and returns 1 then.
+static int run_file(lenv* e, char* path) {
+    int pipe = strcmp(path, "-") == 0;
+    FILE* f = pipe ? stdin : fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "%s: cannot open '%s'\n", lisp_name, path);
+        return 1;
+    }
+
+    lstream* s = lstream_new(f, pipe ? "<stdin>" : path);
+    char* err = NULL;
+    while (1) {
+        lmem_arena_open();
+        lval* x = lstream_read(s, &err);
+        if (x) {eval_print(e, x, s);}
+        lmem_arena_close();
+        lgc_maybe_collect(e);
+        if (x == NULL) {break;}
+    }
+
+    if (err) {
+        fputs(err, stdout);
+        free(err);
+    }
+    lstream_del(s);
+    if (!pipe) {fclose(f);}
+    return err ? 1 : 0;
+}
+
+//Depths are counted in frames, at least one is needed to evaluate anything
+static int parse_depth(const char* s, int* depth) {
+    char* end;
+    errno = 0;
+    long x = strtol(s, &end, 10);
+    if (errno != 0 || end == s || *end != '\0' || x < 1 || x > INT_MAX) {return 0;}
+    *depth = (int)x;
+    return 1;
+}
+
 int main(int argc, char** argv) {
+    int direct_reader = 0;
+    int depth;
+    char** files = malloc(sizeof(char*) * argc);
+    int file_count = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--max-depth") == 0 && i + 1 < argc && parse_depth(argv[i+1], &depth)) {
+            lvm_set_max_depth(depth);
+            i++;
+        } else if (strcmp(argv[i], "--dump-optimized") == 0) {
+            lvm_set_dump_folds(1);
+        } else if (strcmp(argv[i], "--reader") == 0 && i + 1 < argc &&
+                   (strcmp(argv[i+1], "mpc") == 0 || strcmp(argv[i+1], "direct") == 0)) {
+            direct_reader = strcmp(argv[++i], "direct") == 0;
+        } else if (argv[i][0] != '-' || strcmp(argv[i], "-") == 0) {
+            files[file_count++] = argv[i];
+        } else {
+            fprintf(stderr, "usage: %s [--max-depth n] [--dump-optimized] [--reader mpc|direct] "
+                    "[file|- ...]\n", argv[0]);
+            free(files);
+            return 1;
+        }
+    }
+
     //Create parsers
     mpc_parser_t* Number = mpc_new("number");
     mpc_parser_t* Symbol = mpc_new("symbol");
@@ -48,33 +150,44 @@ int main(int argc, char** argv) {
             ",
             Number, Symbol, Sexpr, Qexpr, Expr, plisp);
 
-    printf("%s Version 0.0.0.0.1\n", lisp_name);
-    puts("Press Ctrl+c do Exit\n");
-
     lenv* e = lenv_new();
     lenv_add_builtins(e);
 
-    while (1) {
+    //Scripts are run instead of the REPL
+    int status = 0;
+    for (int i = 0; i < file_count && status == 0; i++) {
+        status = run_file(e, files[i]);
+    }
+
+    if (file_count == 0) {
+        printf("%s Version 0.0.0.0.1\n", lisp_name);
+        puts("Press Ctrl+c do Exit\n");
+    }
+
+    while (file_count == 0) {
         printf("%s%s", lisp_name, prompt_prefix);
         char* input = readline("");
         if (input == NULL) {break;}
         add_history(input);
 
-        mpc_result_t r;
-        if (mpc_parse("<stdin>", input, plisp, &r)) {
-            lval* y = lval_eval(e, lval_read(r.output));
-            lval_println(y);
-            lval_del(y);
-            mpc_ast_delete(r.output);
-        } else {
-            mpc_err_print(r.error);
-            mpc_err_delete(r.error);
-        }
+        //Temporaries of the line go to the arena, defined values are
+        //promoted out of it as they are bound
+        lmem_arena_open();
+        lval* x = read_line(direct_reader ? NULL : plisp, input);
+        if (x) {eval_print(e, x, NULL);}
+        lmem_arena_close();
+        lgc_maybe_collect(e);
         free(input);
     }
 
     lenv_del(e);
+    lval_print_cleanup();
+    lvm_cleanup();
+    lsym_cleanup();
+    lgc_cleanup();
+    lmem_cleanup();
     mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, plisp);
+    free(files);
 
-    return 0;
+    return status;
 }